@@ -1,51 +1,172 @@
-//TODO debug why there is a bit of a double image
 /* Library to display composite video from a framebuffer on an STM32F103C8T6/B */
 #include "bluepill.h"
 #include "composite.h"
 
+//Modes that draw lines from a ring of line buffers instead of straight from the image
+#if defined(COMPOSITE_LINE_RENDERER) || defined(COMPOSITE_SPRITES)
+    #define LINE_BUFFERED
+#endif
+
 /* Constants */
 
 //Step numbers (all values are inclusive) (F1=Field 1, F2=Field 2)
 //Note that during VBlank, 1 step is half the time of a step during the active region
+//A field starts with its vertical sync: equalising, broad (inverted), then equalising half lines
+//When interlacing, one field's vsync starts half way through a line, so there are half line steps
+//where a field ends half way through a line (with a hsync pulse) and where a vsync ends half way
+//through one (without a sync pulse). Field 1 always starts on a whole line, so its lines are on top
 #define FRAME_BEGIN 0
+#define NO_STEP -1//For half lines a mode doesn't have
+
+#ifdef COMPOSITE_PAL
+//625 lines (ITU-R BT.470): 5 equalising, 5 broad, then 5 equalising half lines. Field 1 is the one
+//starting at line 311; field 2's vsync starts half way through line 623 and its image starts at
+//line 23, half a line below line 335 on screen
+#define F1_BEGIN 0//Line 311
+#define F1_VSYNC_BEGIN 0
+#define F1_VSYNC_INV_BEGIN 5//Line 313.5
+#define F1_VSYNC_INV_END 9
+#define F1_VSYNC_REBEGIN 10
+#define F1_VSYNC_END 14
+#define F1_VSYNC_HALF_LINE 15//Second half of line 318 (no sync pulse)
+#define F1_ACTIVE_BEGIN 16//Line 319
+#define F1_VISIBLE_BEGIN 32//Line 335
+#define F1_VISIBLE_END 319//Line 622
+#define F1_ACTIVE_END 319
 
-#define F1_BEGIN 0
+#ifdef COMPOSITE_PROGRESSIVE//312 line fields that all start on a whole line
+    #define F1_END_HALF_LINE NO_STEP
+    #define F1_END 319
+    
+    #define F2_BEGIN 320
+    #define F2_VSYNC_BEGIN 320
+    #define F2_VSYNC_INV_BEGIN 325
+    #define F2_VSYNC_INV_END 329
+    #define F2_VSYNC_REBEGIN 330
+    #define F2_VSYNC_END 334
+    #define F2_VSYNC_HALF_LINE 335
+    #define F2_ACTIVE_BEGIN 336
+    #define F2_VISIBLE_BEGIN 352
+    #define F2_VISIBLE_END 639
+    #define F2_ACTIVE_END 639
+    #define F2_END_HALF_LINE NO_STEP
+    #define F2_END 639
+    
+    #define FRAME_END 639
+#else
+    #define F1_END_HALF_LINE 320//First half of line 623 (hsync, but no image)
+    #define F1_END 320
+    
+    #define F2_BEGIN 321//Line 623.5
+    #define F2_VSYNC_BEGIN 321
+    #define F2_VSYNC_INV_BEGIN 326//Line 1
+    #define F2_VSYNC_INV_END 330
+    #define F2_VSYNC_REBEGIN 331
+    #define F2_VSYNC_END 335
+    #define F2_VSYNC_HALF_LINE NO_STEP
+    #define F2_ACTIVE_BEGIN 336//Line 6
+    #define F2_VISIBLE_BEGIN 353//Line 23
+    #define F2_VISIBLE_END 640//Line 310
+    #define F2_ACTIVE_END 640
+    #define F2_END_HALF_LINE NO_STEP
+    #define F2_END 640
+    
+    #define FRAME_END 640
+#endif
+#else
+//525 lines (SMPTE 170M): 6 equalising, 6 broad, then 6 equalising half lines. Field 2's vsync
+//starts half way through line 263, and its image starts at line 284, half a line below line 21
+#define F1_BEGIN 0//Line 1
 #define F1_VSYNC_BEGIN 0
 #define F1_VSYNC_INV_BEGIN 6
 #define F1_VSYNC_INV_END 11
 #define F1_VSYNC_REBEGIN 12
 #define F1_VSYNC_END 17
-#define F1_ACTIVE_BEGIN 18
-#define F1_VISIBLE_BEGIN 28
-#define F1_VISIBLE_END 269
-#define F1_ACTIVE_END 269
-#define F1_END 269
-
-#define F2_BEGIN 270//Technically 271, but a partial line is useless anyways
-#define F2_VSYNC_BEGIN 270
-#define F2_VSYNC_INV_BEGIN 277
-#define F2_VSYNC_INV_END 282
-#define F2_VSYNC_REBEGIN 283
-#define F2_VSYNC_END 287
-#define F2_ACTIVE_BEGIN 288
-#define F2_VISIBLE_BEGIN 299//Slightly less than 299, but a partial line is useless anyways
-#define F2_VISIBLE_END 540
-#define F2_ACTIVE_END 540
-#define F2_END 540
-
-#define FRAME_END 540
-#define F1_BEGIN_NO_OVERFLOW 541        //Used to make some checks simpler
-#define F1_VSYNC_BEGIN_NO_OVERFLOW 541  //Used to make some checks simpler
+#define F1_VSYNC_HALF_LINE NO_STEP
+#define F1_ACTIVE_BEGIN 18//Line 10
+#define F1_VISIBLE_BEGIN 29//Line 21
+#define F1_VISIBLE_END 270//Line 262
+#define F1_ACTIVE_END 270
+
+#ifdef COMPOSITE_PROGRESSIVE//262 line fields that all start on a whole line
+    #define F1_END_HALF_LINE NO_STEP
+    #define F1_END 270
+    
+    #define F2_BEGIN 271
+    #define F2_VSYNC_BEGIN 271
+    #define F2_VSYNC_INV_BEGIN 277
+    #define F2_VSYNC_INV_END 282
+    #define F2_VSYNC_REBEGIN 283
+    #define F2_VSYNC_END 288
+    #define F2_VSYNC_HALF_LINE NO_STEP
+    #define F2_ACTIVE_BEGIN 289
+    #define F2_VISIBLE_BEGIN 300
+    #define F2_VISIBLE_END 541
+    #define F2_ACTIVE_END 541
+    #define F2_END_HALF_LINE NO_STEP
+    #define F2_END 541
+    
+    #define FRAME_END 541
+#else
+    #define F1_END_HALF_LINE 271//First half of line 263 (hsync, but no image)
+    #define F1_END 271
+    
+    #define F2_BEGIN 272//Line 263.5
+    #define F2_VSYNC_BEGIN 272
+    #define F2_VSYNC_INV_BEGIN 278
+    #define F2_VSYNC_INV_END 283
+    #define F2_VSYNC_REBEGIN 284
+    #define F2_VSYNC_END 289
+    #define F2_VSYNC_HALF_LINE 290//Second half of line 272 (no sync pulse)
+    #define F2_ACTIVE_BEGIN 291//Line 273
+    #define F2_VISIBLE_BEGIN 302//Line 284
+    #define F2_VISIBLE_END 543//Line 525
+    #define F2_ACTIVE_END 543
+    #define F2_END_HALF_LINE NO_STEP
+    #define F2_END 543
+    
+    #define FRAME_END 543
+#endif
+#endif
 
 //Timer values; NOTE: May need manual tuning for a particular microcontroller
-#define TIMER_PSC_VBLANK 0  //Used during vblank steps
+//Sync begins the same number of cycles into every step (the timer counts twice as fast during
+//half line steps), so the spacing of sync pulses doesn't change between full and half lines
+#define TIMER_PSC_VBLANK 0  //Used during half line (vblank) steps
 #define TIMER_PSC_ACTIVE 1  //Used during active steps
-#define TIMER_RELOAD 2288   //15734hz for active steps; double thatfor vblank steps (31468hz)
-#define TIMER_1 53          //1.5us after TIMER_RELOAD (active steps);1.2us vblank/inv vb steps
-#define TIMER_2_ACTIVE 222  //4.7us after TIMER_1 (active steps)
-#define TIMER_2_VB 166      //2.3us after TIMER_1 (vblank steps)
-#define TIMER_2_VB_INV 1951 //27.1us after TIMER_1 (inverted vblank steps)
-#define TIMER_3 392         //4.7us after TIMER_2_REG (active steps);inverted vblank dosn't care
+#define TIMER_NEVER 0xFFFF  //Compare value past TIMER_RELOAD, so the compare never happens
+#ifdef COMPOSITE_PAL
+    #define TIMER_RELOAD 2303   //15625hz for active steps; double that for vblank steps (31250hz)
+    #define TIMER_1_ACTIVE 60   //1.67us after TIMER_RELOAD (active steps)
+    #define TIMER_1_VB 120      //1.67us after TIMER_RELOAD (vblank steps)
+    #define TIMER_2_ACTIVE 229  //4.7us after TIMER_1_ACTIVE (active steps)
+    #define TIMER_2_VB 289      //2.35us after TIMER_1_VB (vblank steps)
+    #define TIMER_2_VB_INV 2086 //27.3us after TIMER_1_VB (inverted vblank steps); leaves a 4.7us serration
+    #define TIMER_2_HALF 458    //4.7us after TIMER_1_VB (half line at the end of field 1)
+    #define TIMER_3 417         //9.9us after the start of sync (active steps); inverted vblank dosn't care
+                                //As far before TIMER_2_HALF as the standard allows: compare 3 still
+                                //interrupts during half line steps, and landing on compare 2 would
+                                //lose its interrupt
+#else
+    #define TIMER_RELOAD 2287   //15734.27hz for active steps; double that for vblank steps (31468.5hz)
+    #define TIMER_1_ACTIVE 54   //1.5us after TIMER_RELOAD (active steps)
+    #define TIMER_1_VB 108      //1.5us after TIMER_RELOAD (vblank steps)
+    #define TIMER_2_ACTIVE 223  //4.7us after TIMER_1_ACTIVE (active steps)
+    #define TIMER_2_VB 274      //2.3us after TIMER_1_VB (vblank steps)
+    #define TIMER_2_VB_INV 2058 //27.1us after TIMER_1_VB (inverted vblank steps); leaves a 4.7us serration
+    #define TIMER_2_HALF 446    //4.7us after TIMER_1_VB (half line at the end of field 1)
+    #define TIMER_3 393         //9.4us after the start of sync (active steps); inverted vblank dosn't care
+#endif
+
+//Cycles from a compare event to the ISR moving the sync pin (or disabling video); measured with
+//the simulator (interrupt entry plus the start of the handler)
+#define TIMER_SYNC_LATENCY 34
+#define TIMER_VIDEO_LATENCY 38//Same for the ISR starting the image (enabling DMA, then SPI)
+#ifdef COMPOSITE_DMA_LINE_START//The line starts exactly on compare 3, so wait for sync's latency too
+    #define TIMER_3_LINE_START (TIMER_3 + (TIMER_SYNC_LATENCY / (TIMER_PSC_ACTIVE + 1)))
+#else
+    #define TIMER_3_LINE_START TIMER_3
+#endif
 
 //Common configuration constants (In one place to allow for easy reuse by macros & init code)
 //SPI_CR1
@@ -57,11 +178,335 @@
 #define DMA_BARE 0x2090//3/4 priority, 8 bit access, memory postincrement, memory to peripheral
 #define DMA_ENABLE (DMA_BARE | 1)//Enables DMA channel 3
 #define DMA_DISABLE DMA_BARE//Does not set channel enable bit unlike DMA_ENABLE
+//DMA_CCR5 (TIM4 CC3 request; only used with COMPOSITE_DMA_LINE_START)
+#define DMA_LINE_START 0x3531//Very high priority, 16 bit access, circular, memory to peripheral, enabled
+//DMA_CCR7 (TIM4 update request; only used with COMPOSITE_HARDWARE_SYNC)
+#define DMA_SYNC_BURST 0x15B1//Medium priority, 16 bit access, memory postincrement, circular, memory to peripheral, enabled
+//TIM4_DIER
+#if defined(COMPOSITE_HARDWARE_SYNC) && defined(COMPOSITE_DMA_LINE_START)
+    #define TIMER_INTERRUPTS_BLANK 0x0502//Compare 1 interrupt, update DMA and compare 2 DMA requests
+#elif defined(COMPOSITE_HARDWARE_SYNC)
+    #define TIMER_INTERRUPTS_BLANK 0x0106//Compare 1 and 2 interrupts and update DMA request
+#elif defined(COMPOSITE_DMA_LINE_START)//Timer compare 3 starts the line with a DMA request instead
+    #define TIMER_INTERRUPTS_BLANK 0x0007//Update and compare 1 and 2 interrupts
+    #define TIMER_INTERRUPTS_VISIBLE 0x0807//Same as blank plus the compare 3 DMA request
+#else
+    #define TIMER_INTERRUPTS_BLANK 0x000F//Update and compare 1, 2, and 3 interrupts
+#endif
+#define TIMER_INTERRUPT_FLAGS (TIMER_INTERRUPTS_BLANK & 0x000F)//Flags in TIM4_SR with interrupts
+//TIM4_DCR (only used with COMPOSITE_HARDWARE_SYNC)
+#define TIMER_DMA_BURST (((SYNC_BURST_LENGTH - 1) << 8) | 11)//Burst to TIM4_ARR (register 11) onwards
+
+/* Step Descriptor Table
+ * Everything the ISR needs to know about a step is precomputed from the step numbers above, so
+ * each interrupt only has to index into stepTable instead of walking range checks and switches.
+ * The table is generated by the preprocessor (one STEP(n) per step) and lives in flash.
+*/
+
+typedef struct
+{
+#if defined(COMPOSITE_LINE_TABLE) && !defined(LINE_BUFFERED)
+    uint16_t line;//Line of the image drawn this step (if visible); index into the line table
+#else
+    uint32_t lineOffset;//Offset into the framebuffer/line buffers of the line drawn this step (over 64KiB for 576 lines)
+#endif
+    uint16_t nextCCR1;//Timer compare value 1 to load for the next step
+    uint16_t nextCCR2;//Timer compare value 2 to load for the next step
+    uint8_t nextPSC;//Timer prescaler to load for the next step
+    uint8_t flags;//STEP_FLAG_* bits
+#ifdef LINE_BUFFERED
+    uint16_t renderLine;//Line of the image to render into a line buffer this step (or NO_LINE)
+#endif
+} stepDescriptor_t;
+
+#define NO_LINE 0xFFFF
+
+//Step flags
+#define STEP_FLAG_VISIBLE (1 << 0)//Step draws a line from the framebuffer
+#define STEP_FLAG_LATCH (1 << 1)//Start of the vblank before a complete image; presents latch here
+#define STEP_FLAG_VBLANK_BEGIN (1 << 2)//Start of a field's vblank (and so the end of the last field)
+#define STEP_FLAG_VBLANK (1 << 3)//Half line (vertical sync) step
+
+//Step classification (all are constant expressions of the step number)
+#define STEP_IS_VSYNC(n) ((((n) >= F1_VSYNC_BEGIN) && ((n) <= F1_VSYNC_END)) || \
+                          (((n) >= F2_VSYNC_BEGIN) && ((n) <= F2_VSYNC_END)))
+#define STEP_IS_VSYNC_HALF_LINE(n) (((n) == F1_VSYNC_HALF_LINE) || ((n) == F2_VSYNC_HALF_LINE))
+#define STEP_IS_END_HALF_LINE(n) (((n) == F1_END_HALF_LINE) || ((n) == F2_END_HALF_LINE))
+#define STEP_IS_HALF_LINE(n) (STEP_IS_VSYNC_HALF_LINE(n) || STEP_IS_END_HALF_LINE(n))
+#define STEP_IS_VBLANK(n) (STEP_IS_VSYNC(n) || STEP_IS_HALF_LINE(n))//Half line steps
+#define STEP_IS_INVERTED(n) ((((n) >= F1_VSYNC_INV_BEGIN) && ((n) <= F1_VSYNC_INV_END)) || \
+                             (((n) >= F2_VSYNC_INV_BEGIN) && ((n) <= F2_VSYNC_INV_END)))
+#define STEP_IS_VISIBLE(n) ((((n) >= F1_VISIBLE_BEGIN) && ((n) <= F1_VISIBLE_END)) || \
+                            (((n) >= F2_VISIBLE_BEGIN) && ((n) <= F2_VISIBLE_END)))
+#define STEP_HAS_SYNC(n) (!STEP_IS_VSYNC_HALF_LINE(n))
+#define STEP_IN_FIELD_1(n) ((n) <= F1_END)
+#ifdef COMPOSITE_INTERLACING//An image spans both fields, so only latch before field 1
+    #define STEP_IS_LATCH(n) ((n) == F1_VSYNC_BEGIN)
+#else//Each field is a complete image
+    #define STEP_IS_LATCH(n) (((n) == F1_VSYNC_BEGIN) || ((n) == F2_VSYNC_BEGIN))
+#endif
+#define STEP_NEXT(n) (((n) == FRAME_END) ? FRAME_BEGIN : ((n) + 1))
+
+//Timer settings used during a step
+#define STEP_PSC(n) (STEP_IS_VBLANK(n) ? TIMER_PSC_VBLANK : TIMER_PSC_ACTIVE)
+#define STEP_SYNC_BEGIN(n) (STEP_IS_VBLANK(n) ? TIMER_1_VB : TIMER_1_ACTIVE)//Count sync would begin at
+#define STEP_CCR1(n) (STEP_HAS_SYNC(n) ? STEP_SYNC_BEGIN(n) : TIMER_NEVER)
+#define STEP_CCR2(n) (STEP_IS_INVERTED(n) ? TIMER_2_VB_INV : \
+                      (STEP_IS_END_HALF_LINE(n) ? TIMER_2_HALF : \
+                       (STEP_IS_VBLANK(n) ? TIMER_2_VB : TIMER_2_ACTIVE)))
+
+//Line of the image drawn during a visible step (relative to the start of the field's image)
+#define STEP_VISIBLE_STEP(n) (STEP_IN_FIELD_1(n) ? ((n) - F1_VISIBLE_BEGIN) : ((n) - F2_VISIBLE_BEGIN))
+#define STEP_VISIBLE_LINE(n) (STEP_VISIBLE_STEP(n) / COMPOSITE_LINE_DIVISOR)
+#ifdef COMPOSITE_INTERLACING//Field 1 draws even lines, field 2 draws odd lines
+    #define STEP_FIELD_LINE_TO_LINE(n, fieldLine) (((fieldLine) * 2) + (STEP_IN_FIELD_1(n) ? 0 : 1))
+#else
+    #define STEP_FIELD_LINE_TO_LINE(n, fieldLine) (fieldLine)
+#endif
+#define STEP_LINE(n) STEP_FIELD_LINE_TO_LINE(n, STEP_VISIBLE_LINE(n))
+#define STEP_LINE_OFFSET(n) (STEP_IS_VISIBLE(n) ? (STEP_LINE(n) * COMPOSITE_BYTES_PER_LINE) : 0)
+#if defined(LINE_BUFFERED)//Offset of the line buffer holding the line
+    #define STEP_SCANOUT(n) (STEP_IS_VISIBLE(n) ? \
+        ((STEP_VISIBLE_LINE(n) % COMPOSITE_LINE_BUFFERS) * COMPOSITE_BYTES_PER_LINE) : 0)
+#elif defined(COMPOSITE_LINE_TABLE)
+    #define STEP_SCANOUT(n) (STEP_IS_VISIBLE(n) ? STEP_LINE(n) : 0)
+#else
+    #define STEP_SCANOUT(n) STEP_LINE_OFFSET(n)
+#endif
+
+#ifdef LINE_BUFFERED
+    //The first COMPOSITE_LINE_BUFFERS - 1 lines of a field are rendered during its vblank (one
+    //per step), then each new line of the field renders the line COMPOSITE_LINE_BUFFERS - 1 ahead
+    //into the line buffer that the previous line was just drawn from
+    #define STEP_VBLANK_STEP(n) (STEP_IN_FIELD_1(n) ? ((n) - F1_VSYNC_BEGIN) : ((n) - F2_VSYNC_BEGIN))
+    #define STEP_IS_PRERENDER(n) (STEP_IS_VBLANK(n) && (STEP_VBLANK_STEP(n) < (COMPOSITE_LINE_BUFFERS - 1)))
+    #define STEP_IS_NEW_LINE(n) (STEP_IS_VISIBLE(n) && ((STEP_VISIBLE_STEP(n) % COMPOSITE_LINE_DIVISOR) == 0))
+    #define STEP_AHEAD_LINE(n) (STEP_VISIBLE_LINE(n) + (COMPOSITE_LINE_BUFFERS - 1))
+    #define STEP_RENDER_LINE(n) (STEP_IS_PRERENDER(n) ? \
+        STEP_FIELD_LINE_TO_LINE(n, STEP_VBLANK_STEP(n)) : \
+        ((STEP_IS_NEW_LINE(n) && (STEP_AHEAD_LINE(n) < COMPOSITE_FIELD_LINES)) ? \
+            STEP_FIELD_LINE_TO_LINE(n, STEP_AHEAD_LINE(n)) : NO_LINE))
+    #define STEP_EXTRA(n) , STEP_RENDER_LINE(n)
+    
+    _Static_assert((COMPOSITE_LINE_BUFFERS - 1) <= (F2_VSYNC_END - F2_VSYNC_BEGIN + 1), "Too many line buffers");
+#else
+    #define STEP_EXTRA(n)
+#endif
+
+#define STEP_FLAGS(n) ((STEP_IS_VISIBLE(n) ? STEP_FLAG_VISIBLE : 0) | \
+                       (STEP_IS_LATCH(n) ? STEP_FLAG_LATCH : 0) | \
+                       ((((n) == F1_VSYNC_BEGIN) || ((n) == F2_VSYNC_BEGIN)) ? STEP_FLAG_VBLANK_BEGIN : 0) | \
+                       (STEP_IS_VBLANK(n) ? STEP_FLAG_VBLANK : 0))
+
+//Expands X(n) for every step of the frame, followed by commas
+//Built from a power of 2 run of steps for each bit set in the number of steps, so it works for any
+//FRAME_END
+#define EACH_STEP_1(X, n) X(n),
+#define EACH_STEP_2(X, n) EACH_STEP_1(X, n) EACH_STEP_1(X, (n) + 1)
+#define EACH_STEP_4(X, n) EACH_STEP_2(X, n) EACH_STEP_2(X, (n) + 2)
+#define EACH_STEP_8(X, n) EACH_STEP_4(X, n) EACH_STEP_4(X, (n) + 4)
+#define EACH_STEP_16(X, n) EACH_STEP_8(X, n) EACH_STEP_8(X, (n) + 8)
+#define EACH_STEP_32(X, n) EACH_STEP_16(X, n) EACH_STEP_16(X, (n) + 16)
+#define EACH_STEP_64(X, n) EACH_STEP_32(X, n) EACH_STEP_32(X, (n) + 32)
+#define EACH_STEP_128(X, n) EACH_STEP_64(X, n) EACH_STEP_64(X, (n) + 64)
+#define EACH_STEP_256(X, n) EACH_STEP_128(X, n) EACH_STEP_128(X, (n) + 128)
+#define EACH_STEP_512(X, n) EACH_STEP_256(X, n) EACH_STEP_256(X, (n) + 256)
+
+#define STEP_COUNT (FRAME_END + 1)
+_Static_assert(STEP_COUNT < 1024, "Too many steps for EACH_STEP");
+#if STEP_COUNT & 512
+    #define EACH_STEP_BIT_9(X) EACH_STEP_512(X, 0)
+#else
+    #define EACH_STEP_BIT_9(X)
+#endif
+#if STEP_COUNT & 256
+    #define EACH_STEP_BIT_8(X) EACH_STEP_256(X, STEP_COUNT & 512)
+#else
+    #define EACH_STEP_BIT_8(X)
+#endif
+#if STEP_COUNT & 128
+    #define EACH_STEP_BIT_7(X) EACH_STEP_128(X, STEP_COUNT & 768)
+#else
+    #define EACH_STEP_BIT_7(X)
+#endif
+#if STEP_COUNT & 64
+    #define EACH_STEP_BIT_6(X) EACH_STEP_64(X, STEP_COUNT & 896)
+#else
+    #define EACH_STEP_BIT_6(X)
+#endif
+#if STEP_COUNT & 32
+    #define EACH_STEP_BIT_5(X) EACH_STEP_32(X, STEP_COUNT & 960)
+#else
+    #define EACH_STEP_BIT_5(X)
+#endif
+#if STEP_COUNT & 16
+    #define EACH_STEP_BIT_4(X) EACH_STEP_16(X, STEP_COUNT & 992)
+#else
+    #define EACH_STEP_BIT_4(X)
+#endif
+#if STEP_COUNT & 8
+    #define EACH_STEP_BIT_3(X) EACH_STEP_8(X, STEP_COUNT & 1008)
+#else
+    #define EACH_STEP_BIT_3(X)
+#endif
+#if STEP_COUNT & 4
+    #define EACH_STEP_BIT_2(X) EACH_STEP_4(X, STEP_COUNT & 1016)
+#else
+    #define EACH_STEP_BIT_2(X)
+#endif
+#if STEP_COUNT & 2
+    #define EACH_STEP_BIT_1(X) EACH_STEP_2(X, STEP_COUNT & 1020)
+#else
+    #define EACH_STEP_BIT_1(X)
+#endif
+#if STEP_COUNT & 1
+    #define EACH_STEP_BIT_0(X) EACH_STEP_1(X, STEP_COUNT & 1022)
+#else
+    #define EACH_STEP_BIT_0(X)
+#endif
+#define EACH_STEP(X) EACH_STEP_BIT_9(X) EACH_STEP_BIT_8(X) EACH_STEP_BIT_7(X) EACH_STEP_BIT_6(X) \
+                     EACH_STEP_BIT_5(X) EACH_STEP_BIT_4(X) EACH_STEP_BIT_3(X) EACH_STEP_BIT_2(X) \
+                     EACH_STEP_BIT_1(X) EACH_STEP_BIT_0(X)
+
+#define STEP(n) {STEP_SCANOUT(n), STEP_CCR1(STEP_NEXT(n)), STEP_CCR2(STEP_NEXT(n)), STEP_PSC(STEP_NEXT(n)), \
+                 STEP_FLAGS(n) STEP_EXTRA(n)}
+
+static const stepDescriptor_t stepTable[] = {EACH_STEP(STEP)};
+_Static_assert((sizeof(stepTable) / sizeof(stepTable[0])) == STEP_COUNT, "Bad step table");
+
+#ifdef COMPOSITE_HARDWARE_SYNC
+    //Timer register values (in the order of TIM4_ARR to TIM4_CCR3) for hardware sync
+    //The timer always runs at 72mhz (prescaler of 0), so step lengths are set with ARR instead
+    #define SYNC_TICKS(n, count) ((count) * (STEP_PSC(n) + 1))//Convert count at the step's prescaler
+    #define SYNC_ARR(n) (SYNC_TICKS(n, TIMER_RELOAD + 1 - STEP_SYNC_BEGIN(n)) + \
+                         SYNC_TICKS(STEP_NEXT(n), STEP_SYNC_BEGIN(STEP_NEXT(n))) - 1)//Next sync begins (the front porch belongs to the next step)
+    //Video is still stopped and started by the compare 1 and 2 interrupts, so those fire early by
+    //the ISR's latency (sync comes straight from the timer, so it has none)
+    #ifdef COMPOSITE_DMA_LINE_START//The compare 2 DMA request starts the image exactly
+        #define SYNC_VIDEO_LATENCY 0
+    #else
+        #define SYNC_VIDEO_LATENCY TIMER_VIDEO_LATENCY
+    #endif
+    #define SYNC_CCR1(n) (SYNC_TICKS(n, TIMER_RELOAD + 1 - STEP_SYNC_BEGIN(n)) - TIMER_SYNC_LATENCY)//Front porch begins
+    #define SYNC_CCR2(n) (STEP_IS_VISIBLE(n) ? (SYNC_TICKS(n, TIMER_3 - TIMER_1_ACTIVE) - SYNC_VIDEO_LATENCY) : \
+                                           0xFFFF)//Image begins
+    #define SYNC_CCR3(n) (STEP_HAS_SYNC(n) ? SYNC_TICKS(n, STEP_CCR2(n) - STEP_SYNC_BEGIN(n)) : 0)//Sync pulse ends
+    #define SYNC_REGISTERS(n) SYNC_ARR(n), 0/*TIM4 has no RCR*/, SYNC_CCR1(n), SYNC_CCR2(n), SYNC_CCR3(n)
+    #define SYNC_BURST_LENGTH 5
+    
+    //The burst at the start of step n (entry n - 1) sets up step n + 1, since the registers are
+    //preloaded. The burst table starts with entry 0 because init sets up steps 0 and 1 itself
+    #define SYNC_BURST(n) {SYNC_REGISTERS(STEP_NEXT(STEP_NEXT(n)))}
+    
+    static const uint16_t syncBurstTable[][SYNC_BURST_LENGTH] = {EACH_STEP(SYNC_BURST)};
+    static const uint16_t syncInitialRegisters[2][SYNC_BURST_LENGTH] = {{SYNC_REGISTERS(0)}, {SYNC_REGISTERS(1)}};
+#endif
+
+//System control block registers (used for PendSV)
+#ifndef SCB_ICSR
+    #define SCB_ICSR (*((volatile uint32_t*)0xE000ED04))
+#endif
+#ifndef SCB_SHPR3
+    #define SCB_SHPR3 (*((volatile uint32_t*)0xE000ED20))
+#endif
+#define SCB_ICSR_PENDSVSET (1 << 28)
+#define PENDSV_PRIORITY_LOWEST (0xFF << 16)//In SCB_SHPR3; below TIM4 so video is never delayed
+
+#ifdef COMPOSITE_STATS
+    //Debug registers used for cycle counting
+    #ifndef DEMCR
+        #define DEMCR (*((volatile uint32_t*)0xE000EDFC))
+    #endif
+    #ifndef DWT_CTRL
+        #define DWT_CTRL (*((volatile uint32_t*)0xE0001000))
+    #endif
+    #ifndef DWT_CYCCNT
+        #define DWT_CYCCNT (*((volatile uint32_t*)0xE0001004))
+    #endif
+    #define DEMCR_TRCENA (1 << 24)//Enables the DWT
+    #define DWT_CTRL_CYCCNTENA 1
+    
+    #define NO_STAT 0xFF//TIM4 ISR that handled several flags at once (not recorded)
+#endif
+
+//Line renderer
+#define RENDER_QUEUE_LENGTH 32//Must be a power of 2 greater than COMPOSITE_LINE_BUFFERS
 
 /* Static Variables */
 
+#if defined(COMPOSITE_LINE_RENDERER)
+static void (*lineRenderer)(uint_fast16_t line, uint8_t* buffer);
+#elif defined(COMPOSITE_LINE_TABLE)
+static const uint8_t* lineTable[COMPOSITE_LINES];//Address of each line of the image
+static volatile uint_fast16_t scroll = 0;//Table entry used for the top line of the image
+static volatile uint_fast16_t pendingScroll;//Applied at the next latch step if presentPending
+#else
 static const uint8_t* frameBuffer;//Pointer to framebuffer//TODO must this be volatile?
-static volatile uint_fast16_t step = -1;//0 to 540
+static const uint8_t* volatile pendingFrameBuffer;//Applied at the next latch step if presentPending
+#endif
+#ifndef COMPOSITE_LINE_RENDERER
+static volatile bool presentPending = false;//Set by present functions, cleared by the ISR
+#endif
+
+#ifdef LINE_BUFFERED
+static uint8_t lineBuffers[COMPOSITE_LINE_BUFFERS][COMPOSITE_BYTES_PER_LINE] __attribute__ ((aligned (4)));
+static volatile uint16_t renderQueue[RENDER_QUEUE_LENGTH];//Lines waiting to be rendered (in order)
+static volatile uint_fast8_t renderQueueHead = 0;//Only written by the TIM4 ISR
+static volatile uint_fast8_t renderQueueTail = 0;//Only written by PendSV
+static void renderLine(uint_fast16_t line, uint8_t* buffer);
+#endif
+
+#ifdef COMPOSITE_TEXT_MODE
+static uint8_t tileMap[COMPOSITE_TEXT_ROWS][COMPOSITE_TEXT_COLUMNS];//Characters on screen
+static const uint8_t* font;//128 characters, 8 bytes each (one per line of the character)
+static void renderTextLine(uint_fast16_t line, uint8_t* buffer);
+#endif
+
+#ifdef COMPOSITE_SPRITES
+typedef struct
+{
+    const uint8_t* volatile bitmap;//widthBytes * height bytes, row by row (0 if the sprite is hidden)
+    const uint8_t* mask;//Same layout as bitmap; set bits clear the image first (0 if none)
+    volatile uint32_t position;//Low half is x (signed), high half is y; one store moves a sprite
+    uint16_t height;//In lines
+    uint8_t widthBytes;//In bytes (8 pixels each)
+    uint8_t mode;//COMPOSITE_SPRITE_OR or COMPOSITE_SPRITE_XOR
+} sprite_t;
+
+static sprite_t sprites[COMPOSITE_SPRITES];
+#endif
+#ifdef COMPOSITE_STATS
+typedef struct
+{
+    uint32_t generation;//The entry is empty (reset) unless this is statsGeneration
+    uint32_t count;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+    uint32_t minLatency;
+    uint32_t maxLatency;
+    uint64_t totalLatency;
+    uint32_t latencyHistogram[COMPOSITE_STATS_BUCKETS];
+} statEntry_t;
+
+static statEntry_t statEntries[COMPOSITE_STAT_INTERRUPTS][COMPOSITE_STAT_CLASSES];//Only written by ISRs
+static volatile uint32_t statsGeneration = 1;//Incremented to reset every entry
+static volatile uint32_t statsSequence = 0;//Incremented after every record; readers retry if it changes
+static volatile uint32_t timerExitCycles;//DWT_CYCCNT at the end of the last TIM4 ISR
+#endif
+static volatile uint_fast16_t step = -1;//0 to FRAME_END
+static const stepDescriptor_t* stepInfo = &stepTable[FRAME_END];//Descriptor for current step
+
+//Callbacks (run from PendSV) and the events the ISR has pended for them
+static void (*vblankCallback)(uint_fast8_t field);
+static void (*fieldEndCallback)(uint_fast8_t field);
+static void (*lineCallback)(uint_fast8_t field);
+static volatile uint_fast16_t lineCallbackStep1 = -1;//Step in field 1 to call lineCallback at
+static volatile uint_fast16_t lineCallbackStep2 = -1;//Step in field 2 to call lineCallback at
+static volatile bool vblankPending = false;
+static volatile bool linePending = false;
+static volatile uint_fast8_t vblankField;//Field the most recent vblank event happened in
+static volatile uint_fast8_t lineField;//Field the most recent line event happened in
 
 /* Useful Macros */
 
@@ -71,17 +516,27 @@ static volatile uint_fast16_t step = -1;//0 to 540
 #define enableSPI() do {SPI1_CR1 = SPI_ENABLE;} while(0)//Enable SPI (PA7 can now change)
 #define enableDMA() do {DMA_CCR3 = DMA_ENABLE;} while(0)//Enable DMA (transfer will begin b/c TXE==1)
 #define disableVideo() do {disableSPI(); disableDMA();} while(0)
-#define enableVideo() do {enableSPI(); enableDMA();} while(0)
-#define syncEnable() do {GPIOB_BRR = 1 << 8;} while(0)//Pull PB8 low
-#define syncDisable() do {GPIOB_BSRR = 1 << 8;} while(0)//Pull PB8 high
+#define enableVideo() do {enableSPI(); enableDMA();} while(0)//Not used with COMPOSITE_DMA_LINE_START
+#define syncEnable() do {GPIOB_BRR = 1 << 8;} while(0)//Pull PB8 low (not with hardware sync)
+#define syncDisable() do {GPIOB_BSRR = 1 << 8;} while(0)//Pull PB8 high (not with hardware sync)
+#define pendEvents() do {SCB_ICSR = SCB_ICSR_PENDSVSET;} while(0)//Run __ISR_PendSV after TIM4
 
 /* Public Functions */
 
 void Composite_init(const uint8_t* fb)//Pointer to framebuffer
 {
+#ifndef COMPOSITE_LINE_RENDERER//There is no framebuffer in line renderer mode
     //Store pointer to framebuffer
-    frameBuffer = fb;
+    Composite_setFramebuffer(fb);
+#endif
     
+#ifdef COMPOSITE_STATS
+    //Start the cycle counter
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    
+#endif
     //Pin Configuration
     GPIOA_CRL = (GPIOA_CRL & 0x0FFFFFFF) | 0xB0000000;//PA7 as 50mhz AF push-pull output
     GPIOB_CRH = (GPIOB_CRH & 0xFFFFFFF0) | 0x00000003;//PB8 as 50mhz push-pull output
@@ -94,106 +549,645 @@ void Composite_init(const uint8_t* fb)//Pointer to framebuffer
     DMA_CCR3 = DMA_DISABLE;//DMA starts disabled
     DMA_CPAR3 = (uint32_t)(&SPI1_DR);//Streaming pixel data to SPI1_DR
     
+#if defined(COMPOSITE_DMA_LINE_START) && defined(COMPOSITE_HARDWARE_SYNC)
+    //DMA Configuration (Channel 4; TIM4_CH2 request)
+    //Each timer compare 2 event copies SPI_ENABLE into SPI1_CR1, starting the line in hardware
+    static const uint16_t spiEnable = SPI_ENABLE;
+    DMA_CCR4 = 0;
+    DMA_CPAR4 = (uint32_t)(&SPI1_CR1);
+    DMA_CMAR4 = (uint32_t)(&spiEnable);
+    DMA_CNDTR4 = 1;//Reloaded automatically since the channel is circular
+    DMA_CCR4 = DMA_LINE_START;
+    
+#elif defined(COMPOSITE_DMA_LINE_START)
+    //DMA Configuration (Channel 5; TIM4_CH3 request)
+    //Each timer compare 3 event copies SPI_ENABLE into SPI1_CR1, starting the line in hardware
+    static const uint16_t spiEnable = SPI_ENABLE;
+    DMA_CCR5 = 0;
+    DMA_CPAR5 = (uint32_t)(&SPI1_CR1);
+    DMA_CMAR5 = (uint32_t)(&spiEnable);
+    DMA_CNDTR5 = 1;//Reloaded automatically since the channel is circular
+    DMA_CCR5 = DMA_LINE_START;
+    
+#endif
     //Timer Configuration
     //Useful Reference:vivonomicon.com/2018/05/20/bare-metal-stm32-programming-part-5-timer-peripherals-and-the-system-clock/
+#ifdef COMPOSITE_HARDWARE_SYNC
+    GPIOB_CRH = (GPIOB_CRH & 0xFFFFFFF0) | 0x0000000B;//PB8 as 50mhz AF push-pull output (TIM4_CH3)
+    
+    //DMA Configuration (Channel 7; TIM4_UP request)
+    DMA_CCR7 = 0;
+    DMA_CPAR7 = (uint32_t)(&TIM4_DMAR);
+    DMA_CMAR7 = (uint32_t)(&syncBurstTable[0][0]);
+    DMA_CNDTR7 = (FRAME_END + 1) * SYNC_BURST_LENGTH;//Reloaded automatically since it's circular
+    DMA_CCR7 = DMA_SYNC_BURST;
+    
+    TIM4_PSC = 0;//Always 72mhz
+    TIM4_CCMR1 = 0x1818;//Set compare channel 1 and 2 to enable flag on match (preloaded)
+    TIM4_CCMR2 = 0x0068;//Set compare channel 3 to PWM mode 1 (preloaded); active while CNT < CCR3
+    TIM4_CCER = 0x0300;//Enable channel 3 output, active low (so PB8 is low during sync)
+    TIM4_DCR = TIMER_DMA_BURST;
+    
+    TIM4_CR1 = 0x0080;//Preload ARR (timer still stopped) so step 1's reload value waits for the update
+    
+    //Load step 0 into the timer, then step 1 into the preload registers; DMA takes it from there
+    for (uint_fast8_t i = 0; i < 2; ++i)
+    {
+        TIM4_ARR = syncInitialRegisters[i][0];
+        TIM4_CCR1 = syncInitialRegisters[i][2];
+        TIM4_CCR2 = syncInitialRegisters[i][3];
+        TIM4_CCR3 = syncInitialRegisters[i][4];
+        
+        if (i == 0)
+            TIM4_EGR = 1;//Generate update event to load step 0 (before update DMA is enabled)
+    }
+    
+    step = 0;//Step 0 starts now, and the first compare 1 interrupt moves on to step 1
+    stepInfo = &stepTable[0];
+    
+    //Callbacks are dispatched from PendSV at the lowest priority so TIM4 always preempts them
+    SCB_SHPR3 = (SCB_SHPR3 & 0xFF00FFFF) | PENDSV_PRIORITY_LOWEST;
+    
+    TIM4_DIER = TIMER_INTERRUPTS_BLANK;//Never changes
+    NVIC_ISER0 = 1 << 30;//Enable timer 4 interrupt in the nvic
+    TIM4_CR1 = 0x0081;//Enable timer (upcounting, ARR preloaded)
+#else
     TIM4_PSC = TIMER_PSC_VBLANK;//Starting at the vertical blanking frequency
     TIM4_ARR = TIMER_RELOAD;//Set reload register value
     
     TIM4_CCMR1 = 0x1818;//Set compare channel 1 and 2 to enable flag on match
     TIM4_CCMR2 = 0x0018;//Set compare channel 3 to enable flag on match
-    TIM4_CCR1 = TIMER_1;//Set compare value for channel 1
+    TIM4_CCR1 = TIMER_1_VB;//Set compare value for channel 1 (starting in VBlank)
     TIM4_CCR2 = TIMER_2_VB;//Set compare value for channel 2 (starting in VBlank)
-    TIM4_CCR3 = TIMER_3;//Set compare value for channel 1
+    TIM4_CCR3 = TIMER_3_LINE_START;//Set compare value for channel 3
     
     TIM4_EGR = 1;//Generate update event to initialize things
     
-    TIM4_DIER = 0x000F;//Enable compare channel 1, 2, and 3, and counter reset (uif) interrupts
+    //Callbacks are dispatched from PendSV at the lowest priority so TIM4 always preempts them
+    SCB_SHPR3 = (SCB_SHPR3 & 0xFF00FFFF) | PENDSV_PRIORITY_LOWEST;
+    
+    TIM4_DIER = TIMER_INTERRUPTS_BLANK;//Enable compare channel 1, 2, (and 3) and counter reset (uif) interrupts
     NVIC_ISER0 = 1 << 30;//Enable timer 4 interrupt in the nvic
     TIM4_CR1 = 1;//Enable timer (upcounting)
+#endif
 }
 
+#ifndef COMPOSITE_LINE_RENDERER
 void Composite_setFramebuffer(const uint8_t* fb)//Pointer to framebuffer
 {
+#ifdef COMPOSITE_LINE_TABLE
+    //Point every line of the table into the framebuffer, in order
+    for (uint_fast16_t i = 0; i < COMPOSITE_LINES; ++i)
+        lineTable[i] = fb + (i * COMPOSITE_BYTES_PER_LINE);
+    
+    scroll = 0;
+#else
     //Store pointer to framebuffer
     frameBuffer = fb;
+#endif
 }
 
+#endif
+
 uint_fast16_t Composite_getCurrentStep()
 {
     return step;
 }
 
+uint_fast16_t Composite_getCurrentLine()
+{
+    const uint_fast16_t currentStep = step;
+    return STEP_IS_VISIBLE(currentStep) ? STEP_LINE(currentStep) : COMPOSITE_LINES;
+}
+
+#ifdef COMPOSITE_LINE_TABLE
+void Composite_setLine(uint_fast16_t line, const uint8_t* address)
+{
+    assert(line < COMPOSITE_LINES);
+    lineTable[line] = address;//Single word write, so the ISR never sees a partial update
+}
+
+const uint8_t* Composite_getLine(uint_fast16_t line)
+{
+    assert(line < COMPOSITE_LINES);
+    return lineTable[line];
+}
+
+void Composite_setScroll(uint_fast16_t firstLine)
+{
+    assert(firstLine < COMPOSITE_LINES);
+    scroll = firstLine;
+}
+
+void Composite_presentScroll(uint_fast16_t firstLine)
+{
+    assert(firstLine < COMPOSITE_LINES);
+    pendingScroll = firstLine;
+    presentPending = true;//Written after the value so the ISR never latches a stale one
+}
+#elif !defined(COMPOSITE_LINE_RENDERER)
+void Composite_present(const uint8_t* fb)
+{
+    pendingFrameBuffer = fb;
+    presentPending = true;//Written after the pointer so the ISR never latches a stale one
+}
+#endif
+
+#ifndef COMPOSITE_LINE_RENDERER
+bool Composite_isPresentPending()
+{
+    return presentPending;
+}
+
+void Composite_waitForPresent()
+{
+    while (presentPending)
+    {
+    #ifdef __arm__
+        __asm__ volatile ("wfi");//Sleep until the next interrupt (at most one step away)
+    #endif
+    }
+}
+#endif
+
+#if defined(COMPOSITE_TEXT_MODE)
+void Composite_setFont(const uint8_t characterRom[128][8])
+{
+    font = (const uint8_t*)(characterRom);
+    lineRenderer = renderTextLine;//Nothing to draw until there is a font
+}
+
+void Composite_setChar(uint_fast8_t column, uint_fast8_t row, char c)
+{
+    assert(column < COMPOSITE_TEXT_COLUMNS);
+    assert(row < COMPOSITE_TEXT_ROWS);
+    tileMap[row][column] = c;
+}
+
+void Composite_drawText(uint_fast8_t column, uint_fast8_t row, const char* string)
+{
+    while (*string)
+    {
+        Composite_setChar(column, row, *(string++));
+        
+        if (++column == COMPOSITE_TEXT_COLUMNS)//Wrap text
+        {
+            column = 0;
+            
+            if (++row == COMPOSITE_TEXT_ROWS)
+                row = 0;
+        }
+    }
+}
+
+uint8_t* Composite_getTileMap()
+{
+    return &tileMap[0][0];
+}
+#elif defined(COMPOSITE_LINE_RENDERER)
+void Composite_setLineRenderer(void (*renderer)(uint_fast16_t line, uint8_t* buffer))
+{
+    lineRenderer = renderer;
+}
+#endif
+
+#ifdef COMPOSITE_SPRITES
+void Composite_setSprite(uint_fast8_t sprite, const uint8_t* bitmap, const uint8_t* mask,
+                         uint_fast8_t widthBytes, uint_fast16_t height, uint_fast8_t mode)
+{
+    assert(sprite < COMPOSITE_SPRITES);
+    sprite_t* const s = &sprites[sprite];
+    
+    s->bitmap = 0;//Hide the sprite while it is changed so a half changed sprite is never drawn
+    __asm__ volatile ("" ::: "memory");//Keep the other stores between hiding and showing it
+    s->mask = mask;
+    s->widthBytes = widthBytes;
+    s->height = height;
+    s->mode = mode;
+    __asm__ volatile ("" ::: "memory");
+    s->bitmap = bitmap;
+}
+
+void Composite_moveSprite(uint_fast8_t sprite, int_fast16_t x, uint_fast16_t y)
+{
+    assert(sprite < COMPOSITE_SPRITES);
+    sprites[sprite].position = ((uint32_t)y << 16) | (uint16_t)x;
+}
+#endif
+
+void Composite_setVBlankCallback(void (*callback)(uint_fast8_t field))
+{
+    vblankCallback = callback;
+}
+
+void Composite_setFieldEndCallback(void (*callback)(uint_fast8_t field))
+{
+    fieldEndCallback = callback;
+}
+
+void Composite_setLineCallback(uint_fast16_t line, void (*callback)(uint_fast8_t field))
+{
+    //Disable the old callback's steps while changing things so it can't fire half-configured
+    lineCallbackStep1 = -1;
+    lineCallbackStep2 = -1;
+    lineCallback = callback;
+    
+    if (callback)
+    {
+        assert(line <= (F1_VISIBLE_END - F1_VISIBLE_BEGIN));
+        lineCallbackStep1 = F1_VISIBLE_BEGIN + line;
+        lineCallbackStep2 = F2_VISIBLE_BEGIN + line;
+    }
+}
+
+#ifdef COMPOSITE_STATS
+void Composite_getStats(uint_fast8_t interrupt, uint_fast8_t stepClass, Composite_stats_t* stats)
+{
+    assert(interrupt < COMPOSITE_STAT_INTERRUPTS);
+    assert(stepClass < COMPOSITE_STAT_CLASSES);
+    
+    const statEntry_t* const entry = &statEntries[interrupt][stepClass];
+    
+    //Copy the entry, starting over if an interrupt recorded anything in the middle of it
+    uint32_t sequence;
+    do
+    {
+        sequence = statsSequence;
+        __asm__ volatile ("" ::: "memory");//Don't let the compiler move the copy out of the loop
+        
+        if ((entry->generation != statsGeneration) || !entry->count)//Nothing since the last reset
+        {
+            stats->count = 0;
+            stats->minCycles = stats->maxCycles = stats->meanCycles = 0;
+            stats->minLatency = stats->maxLatency = stats->meanLatency = 0;
+            for (uint_fast8_t i = 0; i < COMPOSITE_STATS_BUCKETS; ++i)
+                stats->latencyHistogram[i] = 0;
+        }
+        else
+        {
+            stats->count = entry->count;
+            stats->minCycles = entry->minCycles;
+            stats->maxCycles = entry->maxCycles;
+            stats->meanCycles = entry->totalCycles / entry->count;
+            stats->minLatency = entry->minLatency;
+            stats->maxLatency = entry->maxLatency;
+            stats->meanLatency = entry->totalLatency / entry->count;
+            for (uint_fast8_t i = 0; i < COMPOSITE_STATS_BUCKETS; ++i)
+                stats->latencyHistogram[i] = entry->latencyHistogram[i];
+        }
+        
+        __asm__ volatile ("" ::: "memory");
+    }
+    while (sequence != statsSequence);
+}
+
+void Composite_resetStats()
+{
+    ++statsGeneration;//Entries are cleared by the ISRs the next time they record to them
+}
+#endif
+
+/* Line Buffer Rendering */
+
+#ifdef LINE_BUFFERED
+static void renderLine(uint_fast16_t line, uint8_t* buffer)
+{
+    //Start with the line of the image
+#if defined(COMPOSITE_LINE_RENDERER)
+    if (lineRenderer)
+        lineRenderer(line, buffer);
+#else
+    #ifdef COMPOSITE_LINE_TABLE
+        uint_fast16_t entry = line + scroll;//Rotate the table by the scroll amount
+        if (entry >= COMPOSITE_LINES)
+            entry -= COMPOSITE_LINES;
+        
+        const uint8_t* source = lineTable[entry];
+    #else
+        const uint8_t* source = frameBuffer + (line * COMPOSITE_BYTES_PER_LINE);
+    #endif
+    
+    for (uint_fast8_t i = 0; i < COMPOSITE_BYTES_PER_LINE; ++i)
+        buffer[i] = source[i];
+#endif
+    
+#ifdef COMPOSITE_SPRITES
+    //Then draw sprites on top of it
+    for (uint_fast8_t i = 0; i < COMPOSITE_SPRITES; ++i)
+    {
+        const sprite_t* const sprite = &sprites[i];
+        const uint8_t* const spriteBitmap = sprite->bitmap;
+        if (!spriteBitmap)//Hidden
+            continue;
+        
+        const uint32_t position = sprite->position;
+        const int_fast16_t x = (int16_t)(position & 0xFFFF);
+        const uint_fast16_t row = line - (position >> 16);//Row of the sprite on this line
+        if (row >= sprite->height)//Also catches lines above the sprite as row wraps around
+            continue;
+        
+        const uint_fast8_t widthBytes = sprite->widthBytes;
+        const uint8_t* const bitmap = spriteBitmap + (row * widthBytes);
+        const uint8_t* const mask = sprite->mask ? (sprite->mask + (row * widthBytes)) : 0;
+        const uint_fast8_t shift = x & 7;//Sprite bytes straddle 2 image bytes unless aligned
+        int_fast16_t destination = x >> 3;//Image byte (can start off the left side)
+        uint_fast16_t bits = 0, maskBits = 0;//Previous sprite byte in high half, current in low
+        
+        for (uint_fast8_t j = 0; j <= widthBytes; ++j, ++destination)//1 more for the spill over
+        {
+            bits = (bits << 8) | ((j < widthBytes) ? bitmap[j] : 0);
+            maskBits = (maskBits << 8) | ((mask && (j < widthBytes)) ? mask[j] : 0);
+            
+            if ((destination < 0) || (destination >= COMPOSITE_BYTES_PER_LINE))//Clip
+                continue;
+            
+            const uint8_t shiftedBits = bits >> shift;
+            const uint8_t shiftedMask = maskBits >> shift;
+            uint8_t pixels = buffer[destination] & ~shiftedMask;
+            
+            if (sprite->mode == COMPOSITE_SPRITE_XOR)
+                pixels ^= shiftedBits;
+            else
+                pixels |= shiftedBits;
+            
+            buffer[destination] = pixels;
+        }
+    }
+#endif
+}
+#endif
+
+/* Text Mode Renderer */
+
+#ifdef COMPOSITE_TEXT_MODE
+//Word access into a line buffer at any address (only the first line buffer is aligned unless
+//COMPOSITE_BYTES_PER_LINE is a multiple of 4); single unaligned STRs are fine on the M3
+typedef uint32_t __attribute__ ((may_alias, aligned (1))) unalignedWord_t;
+
+static void renderTextLine(uint_fast16_t line, uint8_t* buffer)
+{
+    const uint_fast16_t row = line / 8;
+    
+    if (row >= COMPOSITE_TEXT_ROWS)//Leftover lines below the last row of text
+    {
+        for (uint_fast8_t i = 0; i < COMPOSITE_BYTES_PER_LINE; ++i)
+            buffer[i] = 0x00;
+        
+        return;
+    }
+    
+    const uint8_t* tiles = tileMap[row];
+    const uint8_t* const glyphLine = font + (line % 8);//Line of the first character in the font
+    #define GLYPH(c) ((uint32_t)glyphLine[((c) & 0x7F) * 8])//Line of a character in the font
+    
+    //4 characters per store; bytes are little endian so the first character is lowest
+    unalignedWord_t* words = (unalignedWord_t*)buffer;
+    for (uint_fast8_t i = 0; i < (COMPOSITE_BYTES_PER_LINE / 4); ++i)
+    {
+        *(words++) = GLYPH(tiles[0]) | (GLYPH(tiles[1]) << 8) | (GLYPH(tiles[2]) << 16) |
+                     (GLYPH(tiles[3]) << 24);
+        tiles += 4;
+    }
+    
+    //Remaining characters
+    buffer = (uint8_t*)words;
+    for (uint_fast8_t i = 0; i < (COMPOSITE_BYTES_PER_LINE % 4); ++i)
+        buffer[i] = GLYPH(tiles[i]);
+    
+    #undef GLYPH
+}
+#endif
+
 /* Private Functions
  * Timer Reset: Disable video for front porch, increment step, detect if visible region
  * Timer CMP 1: Enable sync; if visible region, configure DMA for current step/line number
  * Timer CMP 2: Disable sync (back porch); configure timer settings for next step
  * Timer CMP 3: Enable video and DMA to start drawing pixels for the current line
+ *  With COMPOSITE_DMA_LINE_START, CMP 1 enables DMA, and the CMP 3 DMA request enables SPI (so
+ *  there is no CMP 3 interrupt); the request is only enabled during visible steps
  * Timer ARR value hit: Apply new timer frequency and compare values and reset timer
+ * PendSV: Run callbacks for events pended by the TIM4 ISR (lowest priority)
+ * 
+ * With COMPOSITE_HARDWARE_SYNC, the timer starts counting at the start of the sync pulse, and
+ * channel 3 drives PB8 directly (low while the count is below CCR3). Each update event has DMA
+ * channel 7 burst the next step's ARR/CCR1/CCR2/CCR3 from syncBurstTable into the (preloaded)
+ * registers, so only these interrupts are left:
+ * Timer CMP 1: Disable video for front porch, increment step, configure DMA for the new step
+ * Timer CMP 2: Enable video and DMA (or the CMP 2 DMA request enables SPI with
+ *  COMPOSITE_DMA_LINE_START). CCR2 is out of range during non-visible steps so it never fires
 */
 
+#ifdef COMPOSITE_STATS
+//Adds an interrupt that took cycles and started latency cycles late to the current step's stats
+static void recordStat(uint_fast8_t interrupt, uint32_t cycles, uint32_t latency)
+{
+    const uint_fast8_t flags = stepInfo->flags;
+    const uint_fast8_t stepClass = (flags & STEP_FLAG_VBLANK) ? COMPOSITE_STAT_VBLANK :
+                                   ((flags & STEP_FLAG_VISIBLE) ? COMPOSITE_STAT_VISIBLE :
+                                                                  COMPOSITE_STAT_BLANK);
+    statEntry_t* const entry = &statEntries[interrupt][stepClass];
+    
+    if (entry->generation != statsGeneration)//Reset since the last record
+    {
+        entry->generation = statsGeneration;
+        entry->count = 0;
+        entry->minCycles = UINT32_MAX;
+        entry->maxCycles = 0;
+        entry->totalCycles = 0;
+        entry->minLatency = UINT32_MAX;
+        entry->maxLatency = 0;
+        entry->totalLatency = 0;
+        for (uint_fast8_t i = 0; i < COMPOSITE_STATS_BUCKETS; ++i)
+            entry->latencyHistogram[i] = 0;
+    }
+    
+    ++entry->count;
+    
+    if (cycles < entry->minCycles)
+        entry->minCycles = cycles;
+    if (cycles > entry->maxCycles)
+        entry->maxCycles = cycles;
+    entry->totalCycles += cycles;
+    
+    if (latency < entry->minLatency)
+        entry->minLatency = latency;
+    if (latency > entry->maxLatency)
+        entry->maxLatency = latency;
+    entry->totalLatency += latency;
+    
+    uint32_t bucket = latency / COMPOSITE_STATS_BUCKET_CYCLES;
+    if (bucket >= COMPOSITE_STATS_BUCKETS)
+        bucket = COMPOSITE_STATS_BUCKETS - 1;
+    ++entry->latencyHistogram[bucket];
+    
+    ++statsSequence;
+}
+
+//Returns the cycles between the event behind timer flag interrupt and count (TIM4_CNT on entry)
+//Must be called before the ISR changes TIM4_CCR2 or moves on to the next step
+static inline __attribute__ ((always_inline)) uint32_t timerLatency(uint_fast8_t interrupt,
+                                                                     uint_fast16_t count)
+{
+#ifdef COMPOSITE_HARDWARE_SYNC
+    //The compare registers already hold the next step's values, so get the current ones from the
+    //burst table. The timer always runs at 72mhz
+    const uint_fast16_t current = step;
+    const uint16_t* const registers = syncBurstTable[(current >= 2) ? (current - 2) :
+                                                                      (current + FRAME_END - 1)];
+    return count - registers[interrupt + 1];//CCR1 or CCR2
+#else
+    if (interrupt == COMPOSITE_STAT_UPDATE)
+        return count * (stepInfo->nextPSC + 1);//The timer just switched to the next step's prescaler
+    
+    uint_fast16_t compare;
+    if (interrupt == COMPOSITE_STAT_CC1)
+        compare = (stepInfo->flags & STEP_FLAG_VBLANK) ? TIMER_1_VB : TIMER_1_ACTIVE;
+    else if (interrupt == COMPOSITE_STAT_CC2)
+        compare = TIM4_CCR2;
+    else
+        compare = TIMER_3;
+    
+    const uint_fast8_t prescaler = (stepInfo->flags & STEP_FLAG_VBLANK) ? TIMER_PSC_VBLANK :
+                                                                          TIMER_PSC_ACTIVE;
+    return (count - compare) * (prescaler + 1);
+#endif
+}
+#endif
+
+//Disables video at the start of the front porch and moves on to the next step
+static inline __attribute__ ((always_inline)) void beginStep()
+{
+    //Disable SPI and DMA for the front porch and rest of hblank/vblank
+    disableVideo();
+    
+    //Determine the current step and update
+    if (step == FRAME_END)
+        step = 0;//Wrap around to first step
+    else
+        ++step;//Increment step
+    
+    const stepDescriptor_t* const info = &stepTable[step];
+    stepInfo = info;//Everything else about the step comes from here
+    
+#if defined(COMPOSITE_DMA_LINE_START) && !defined(COMPOSITE_HARDWARE_SYNC)
+    //Only let timer compare 3 start a line if there is one this step
+    TIM4_DIER = (info->flags & STEP_FLAG_VISIBLE) ? TIMER_INTERRUPTS_VISIBLE :
+                                                    TIMER_INTERRUPTS_BLANK;
+#endif
+    
+#ifndef COMPOSITE_LINE_RENDERER
+    //Apply a pending present now that no line of the image is being drawn
+    if ((info->flags & STEP_FLAG_LATCH) && presentPending)
+    {
+    #ifdef COMPOSITE_LINE_TABLE
+        scroll = pendingScroll;
+    #else
+        frameBuffer = pendingFrameBuffer;
+    #endif
+        presentPending = false;
+    }
+#endif
+    
+#ifdef LINE_BUFFERED
+    //Queue up a line to render into the line buffer that was drawn from last
+    if (info->renderLine != NO_LINE)
+    {
+        const uint_fast8_t head = renderQueueHead;
+        const uint_fast8_t nextHead = (head + 1) & (RENDER_QUEUE_LENGTH - 1);
+        
+        if (nextHead != renderQueueTail)//If full the renderer is hopelessly behind; skip
+        {
+            renderQueue[head] = info->renderLine;
+            renderQueueHead = nextHead;
+        }
+        
+        pendEvents();
+    }
+#endif
+    
+    //Pend callbacks for beam events; they run in PendSV once this ISR is done
+    if (info->flags & STEP_FLAG_VBLANK_BEGIN)
+    {
+        vblankField = STEP_IN_FIELD_1(step) ? 1 : 2;
+        vblankPending = true;
+        pendEvents();
+    }
+    else if ((step == lineCallbackStep1) || (step == lineCallbackStep2))
+    {
+        lineField = STEP_IN_FIELD_1(step) ? 1 : 2;
+        linePending = true;
+        pendEvents();
+    }
+}
+
+//Sets up DMA for the current step if it is a visible line step (non-vblank)
+static inline __attribute__ ((always_inline)) void setupLine()
+{
+    const stepDescriptor_t* const info = stepInfo;
+    if (info->flags & STEP_FLAG_VISIBLE)
+    {
+        DMA_CNDTR3 = COMPOSITE_BYTES_PER_LINE;//Reset transfer counter
+    #if defined(LINE_BUFFERED)
+        DMA_CMAR3 = (uint32_t)(&lineBuffers[0][0] + info->lineOffset);//Start of line
+    #elif defined(COMPOSITE_LINE_TABLE)
+        uint_fast16_t entry = info->line + scroll;//Rotate the table by the scroll amount
+        if (entry >= COMPOSITE_LINES)
+            entry -= COMPOSITE_LINES;
+        
+        DMA_CMAR3 = (uint32_t)lineTable[entry];//Start of line
+    #else
+        DMA_CMAR3 = (uint32_t)(frameBuffer + info->lineOffset);//Start of line
+    #endif
+    
+    #ifdef COMPOSITE_DMA_LINE_START
+        //The first byte is loaded into SPI1_DR now, but nothing is shifted out until the
+        //timer compare DMA request enables SPI at the end of the back porch
+        enableDMA();
+    #endif
+    }
+}
+
 __attribute__ ((interrupt ("IRQ"))) void __ISR_TIM4()
 {
-    static bool isVisibleStep;//Used to evaluate current region faster in t cmp interrupt 3
+#ifdef COMPOSITE_STATS
+    const uint32_t entryCycles = DWT_CYCCNT;//As early as possible
+    const uint_fast16_t entryCount = TIM4_CNT;
+#endif
     uint_fast16_t timerStatus = TIM4_SR;//Save value of TIM4_SR for speed (atomicity unneeded)
     TIM4_SR = 0;//Clear all flags "the fast way" (instead of clearing individually in switch)
     
-    switch (timerStatus & 0x000F)
+#ifdef COMPOSITE_STATS
+    const uint_fast16_t flags = timerStatus & TIMER_INTERRUPT_FLAGS;
+    const uint_fast8_t statInterrupt = (flags && !(flags & (flags - 1))) ? __builtin_ctz(flags) : NO_STAT;
+    const uint32_t latency = (statInterrupt != NO_STAT) ? timerLatency(statInterrupt, entryCount) : 0;
+#endif
+    
+    switch (timerStatus & TIMER_INTERRUPT_FLAGS)//Ignore flags without interrupts enabled
     {
+#ifdef COMPOSITE_HARDWARE_SYNC
+        case 1 << 1://Timer compare match 1: Start of front porch (and of step)
+        {
+            beginStep();
+            setupLine();//Sync and the back porch are long enough to do this now
+            break;
+        }
+    #ifndef COMPOSITE_DMA_LINE_START
+        case 1 << 2://Timer compare match 2: End of back porch, start of image
+        {
+            enableVideo();//Only fires during visible steps
+            break;
+        }
+    #endif
+#else
         case 1://Timer count reset to 0: Start of front porch (and of step)
         {
-            //Disable SPI and DMA for the front porch and rest of hblank/vblank
-            disableVideo();
-            
-            //Determine the current step and update
-            if (step == FRAME_END)
-                step = 0;//Wrap around to first step
-            else
-                ++step;//Increment step
-            
-            //Determine if this step is visible (if DMA will need configuration before t cmp 3)
-            //TODO disable/enable tc3 on the fly instead of using isVisibleStep
-            isVisibleStep = (((step >= F1_VISIBLE_BEGIN)  && (step <= F1_VISIBLE_END)) ||
-                             ((step >= F2_VISIBLE_BEGIN)/*&& (step <= F2_VISIBLE_END)*/));
-                
+            beginStep();
             break;
         }
         case 1 << 1://Timer compare match 1: Start of sync pulse (end of front porch)
         {
             syncEnable();
-            
-            //Sets up DMA for the current step if it is a visible line step (non-vblank)
-            if (isVisibleStep)
-            {
-                DMA_CNDTR3 = COMPOSITE_BYTES_PER_LINE;//Reset transfer counter
-                
-                //Setup initial DMA memory address
-                uint32_t visibleLine;//Relative to start of visible region
-                uint32_t offset;//Relative to start of frame buffer
-                const bool inField1 = step <= F1_END;
-                
-                //Determine value of visibleLine based on current field
-                if (inField1)//In field 1
-                    visibleLine = step - F1_VISIBLE_BEGIN;//Relative to F1_VISIBLE_BEGIN
-                else
-                    visibleLine = step - F2_VISIBLE_BEGIN;//Relative to F2_VISIBLE_BEGIN
-                
-                visibleLine /= COMPOSITE_LINE_DIVISOR;//Repeat lines if specified by constant
-                
-                //Determine offset into framebuffer
-                #ifdef COMPOSITE_INTERLACING
-                    offset = visibleLine * (COMPOSITE_BYTES_PER_LINE * 2);//Even lines
-                
-                    if (!inField1)//If we're in field 2
-                        offset += COMPOSITE_BYTES_PER_LINE;//Make odd lines by adding to even
-                #else//Not interlacing
-                    offset = visibleLine * COMPOSITE_BYTES_PER_LINE;
-                #endif
-                
-                //Set initial DMA memory address based on frame buffer pointer and offset
-                const uint8_t const* lineAddress = frameBuffer + offset;
-                DMA_CMAR3 = (uint32_t)lineAddress;
-            }
-            
+            setupLine();
             break;
         }
         case 1 << 2://Timer compare match 2: End of sync pulse (start of back porch for hblank)
@@ -202,66 +1196,91 @@ __attribute__ ((interrupt ("IRQ"))) void __ISR_TIM4()
             //interrupt will fire at a different amount of time after the timer compare 1 one
             syncDisable();
             
-            //Configures timer prescaler and second timer compare value for the next step
-            //Remember that update even occurs every time the timer is reloaded with 0
-            uint_fast16_t dumbNextStep = step + 1;//Does not take overflow of 540 into account
-            switch (dumbNextStep)//Prescaler
-            {
-                //Next step will be the start of a VBlank region
-                case F1_VSYNC_BEGIN_NO_OVERFLOW://VBlank region of field 1
-                case F2_VSYNC_BEGIN://VBlank region of field 2
-                {
-                    TIM4_PSC = TIMER_PSC_VBLANK;//Double the timer's frequency (31468hz)
-                    break;
-                }
-                //Next step will be the start of an active region
-                case F1_ACTIVE_BEGIN:
-                case F2_ACTIVE_BEGIN:
-                {
-                    TIM4_PSC = TIMER_PSC_ACTIVE;//Regular frequency (15734hz)
-                    break;
-                }
-            }
-            
-            switch (dumbNextStep)//Timer compare value 2
-            {
-                //Next step will be the start of a non-inverted vblank region
-                case F1_VSYNC_BEGIN_NO_OVERFLOW://1st non-inverted vblank region of field 1
-                case F1_VSYNC_REBEGIN://2nd non-inverted vblank region of field 1
-                case F2_VSYNC_BEGIN://1st non-inverted vblank region of field 2
-                case F2_VSYNC_REBEGIN://2nd non-inverted vblank region of field 2
-                {
-                    TIM4_CCR2 = TIMER_2_VB;//Adjust timer compare int 2 for 2.3us sync pulse
-                    break;
-                }
-                //Next step will be the start of an inverted vblank region
-                case F1_VSYNC_INV_BEGIN://Inverted vblank region of field 1
-                case F2_VSYNC_INV_BEGIN://Inverted vblank region of field 2
-                {
-                    TIM4_CCR2 = TIMER_2_VB_INV;//Adjust timer cmp int 2 for 27.1us sync pulse
-                    break;
-                }
-                //Next step will be the start of an active region
-                case F1_ACTIVE_BEGIN:
-                case F2_ACTIVE_BEGIN:
-                {
-                    TIM4_CCR2 = TIMER_2_ACTIVE;//Adjust timer compare int 2 for 4.7us sync pulse
-                    break;
-                }
-            }
+            //Configures timer prescaler and first and second timer compare values for the next step
+            //All are preloaded, so they only take effect when the timer is next reloaded with 0
+            const stepDescriptor_t* const info = stepInfo;
+            TIM4_PSC = info->nextPSC;
+            TIM4_CCR1 = info->nextCCR1;
+            TIM4_CCR2 = info->nextCCR2;
             
             break;
         }
+    #ifndef COMPOSITE_DMA_LINE_START
         case 1 << 3://Timer compare match 3: End of back porch, start of image
         {
             //Start drawing the image for the line. We can assume that this line is a visible 
             //line because otherwise the timer compare 3 interrupt would not have fired
             //TODO disable/enable tc3 on the fly as explained above instead of this
             //TODO would save an if statement and avoid timer compare interupt 3 during vblank
-            if (isVisibleStep)//Remove this
+            if (stepInfo->flags & STEP_FLAG_VISIBLE)//Remove this
                 enableVideo();//Just keep this
             
             break;
         }
+    #endif
+#endif
     }
+    
+#ifdef COMPOSITE_STATS
+    if (statInterrupt != NO_STAT)
+        recordStat(statInterrupt, DWT_CYCCNT - entryCycles, latency);
+    
+    timerExitCycles = DWT_CYCCNT;
+#endif
+}
+
+__attribute__ ((interrupt ("IRQ"))) void __ISR_PendSV()
+{
+#ifdef COMPOSITE_STATS
+    const uint32_t entryCycles = DWT_CYCCNT;
+    const uint32_t latency = entryCycles - timerExitCycles;
+    
+#endif
+#ifdef LINE_BUFFERED
+    //Render queued lines first since they have a deadline
+    uint_fast8_t tail = renderQueueTail;
+    while (tail != renderQueueHead)
+    {
+        const uint_fast16_t line = renderQueue[tail];
+        
+        #ifdef COMPOSITE_INTERLACING
+            const uint_fast16_t fieldLine = line / 2;
+        #else
+            const uint_fast16_t fieldLine = line;
+        #endif
+        
+        renderLine(line, lineBuffers[fieldLine % COMPOSITE_LINE_BUFFERS]);
+        
+        tail = (tail + 1) & (RENDER_QUEUE_LENGTH - 1);
+        renderQueueTail = tail;
+    }
+#endif
+    
+    //Lines queued while the callbacks run wait until they return (see Composite_setVBlankCallback)
+    //Each event has its own field, read after clearing its flag so one pended in between isn't lost
+    if (vblankPending)
+    {
+        vblankPending = false;
+        const uint_fast8_t field = vblankField;
+        
+        //The field before this vblank just finished; field 1 is preceded by field 2
+        if (fieldEndCallback)
+            fieldEndCallback((field == 1) ? 2 : 1);
+        
+        if (vblankCallback)
+            vblankCallback(field);
+    }
+    
+    if (linePending)
+    {
+        linePending = false;
+        const uint_fast8_t field = lineField;
+        
+        if (lineCallback)
+            lineCallback(field);
+    }
+    
+#ifdef COMPOSITE_STATS
+    recordStat(COMPOSITE_STAT_PENDSV, DWT_CYCCNT - entryCycles, latency);//TIM4 time included
+#endif
 }
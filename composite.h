@@ -1,12 +1,13 @@
 /* Library to display composite video from a framebuffer on an STM32F103C8T6/B
  * 
- * Hardcoded to use DMA channel 3, SPI1, and TIM4.
+ * Hardcoded to use DMA channel 3, SPI1, TIM4, and PendSV (and DMA channel 5 if
+ * COMPOSITE_DMA_LINE_START, or 4 and 7 with COMPOSITE_HARDWARE_SYNC).
  * Hardcoded to output
  * 
 ** Capabilities
- * Maximum resolution (H,V): 944, 484
+ * Maximum resolution (H,V): 944, 484 (NTSC) or 944, 576 (PAL)
  * H resolution may increase/decrease in steps of 8 pixels; can be scaled by powers of 2
- * V resolution may either be interlaced/not (484/242)
+ * V resolution may either be interlaced/not (484/242, or 576/288 with COMPOSITE_PAL)
  * Note that a composite monitor will only use 720 horizontal pixel samples
  *  Because of SPI prescaler limitations, there is no way to get 720 pixels across without
  *  wasting space on the right side. Recommend stretching original 720x484 image to
@@ -15,7 +16,7 @@
 ** Setting Resolution
  * Modify the preprocessor constants within this file
  * Vertical
- *  Decide if INTERLACING
+ *  Decide if INTERLACING (or PROGRESSIVE for 240p; otherwise each field is drawn half a line apart)
  *  //TODO implement vertical scaling
  * Horizontal
  *  Choose SPI prescaler (length of horizontal pixels)
@@ -23,6 +24,36 @@
  *   Can choose other vals, but those are the most useful. 0b000 is overclocking, but gives 1856
  *   //TODO validate those are indeed the maximum h pixels on screen
  *  Choose number of byte per line. 1 byte = 8 pixels. Can be less than max h pixels
+ * 
+** Line Table Mode (COMPOSITE_LINE_TABLE)
+ * Instead of reading one contiguous framebuffer, each line is read through a table of
+ * COMPOSITE_LINES line pointers (~4 bytes of ram per line). Lines can point anywhere (ram or
+ * flash) and may be repeated, and the table can be rotated with Composite_setScroll, so scrolling
+ * vertically is a single write instead of moving the whole framebuffer
+ * Composite_init/Composite_setFramebuffer still work; they point each line into the buffer
+ * 
+** Line Renderer Mode (COMPOSITE_LINE_RENDERER)
+ * There is no framebuffer at all. Lines are drawn from a ring of COMPOSITE_LINE_BUFFERS line
+ * buffers, which a callback (see Composite_setLineRenderer) fills just in time, a few lines before
+ * they are drawn. This allows the full resolution with only a few hundred bytes of ram, as long as
+ * each line can be generated in less than a line's time (~63us)
+ * 
+** Text Mode (COMPOSITE_TEXT_MODE)
+ * A line renderer mode where composite builds each line itself from a tile map of characters
+ * (COMPOSITE_TEXT_COLUMNS by COMPOSITE_TEXT_ROWS bytes) and an 8x8 font (bitmaps/vincent.h format)
+ * Changing a character on screen is a single byte write, and full resolution text only needs
+ * ~7KiB of ram instead of a ~57KiB framebuffer
+ * 
+** Sprites (COMPOSITE_SPRITES)
+ * Up to COMPOSITE_SPRITES 1bpp sprites (with an optional mask) are drawn on top of each line as
+ * it is copied into a line buffer, so the framebuffer is never touched. Moving a sprite is a
+ * single store. Works in every mode; COMPOSITE_LINE_BUFFERS line buffers are used to draw from
+ * 
+** Stats (COMPOSITE_STATS)
+ * Every TIM4 and PendSV interrupt is timed with the DWT cycle counter. Composite_getStats gives the
+ * min/max/mean cycles spent in an interrupt and its latency (cycles from the timer event to the
+ * first instruction of the ISR, plus a histogram) for each class of step, which shows how much
+ * time is left over for rendering. Use Composite_resetStats before measuring something new
  *  
 ** Hardware
  *  Schematic (ALL OUTPUTS ARE PUSH-PULL)
@@ -76,9 +107,177 @@
 //#define COMPOSITE_SPI_PRESCALER_VALUE 0b001
 ////#define COMPOSITE_LINE_DIVISOR 1//Don't repeat any lines
 
+//240p: fields are 262 lines instead of 262.5, so every field starts on a whole line and the lines
+//of both fields are drawn in the same place (a stable 60hz image without interlace flicker)
+//Can't be used with COMPOSITE_INTERLACING
+//#define COMPOSITE_PROGRESSIVE
+
+//PAL: 625 line, 50hz video (15625hz lines, 312.5 line fields with 5 pulse equalising/broad
+//sequences) with 288 lines per field instead of NTSC's 242. Works with every other setting,
+//including COMPOSITE_PROGRESSIVE (288p, 312 line fields)
+//#define COMPOSITE_PAL
+
+//Line table mode (see above)
+//#define COMPOSITE_LINE_TABLE
+
+//Line renderer mode (see above)
+//#define COMPOSITE_LINE_RENDERER
+//#define COMPOSITE_LINE_BUFFERS 2//Lines rendered ahead + 1 (each costs COMPOSITE_BYTES_PER_LINE)
+
+//Text mode (see above; implies line renderer mode)
+//#define COMPOSITE_TEXT_MODE
+
+//Sprites (see above)
+//#define COMPOSITE_SPRITES 4//Number of sprites
+
+//Start each line with a DMA request from timer compare 3 instead of an interrupt. This saves an
+//interrupt per step and removes interrupt latency jitter from the left edge of the image
+//#define COMPOSITE_DMA_LINE_START
+
+//Generate sync on PB8 (TIM4_CH3) with the timer instead of toggling it in interrupts. Timer settings
+//for each step are loaded by DMA, so sync edges have no jitter and there are 2 less interrupts per step
+//#define COMPOSITE_HARDWARE_SYNC
+
+//Record how many cycles each interrupt takes and how late it starts (see Composite_getStats)
+//Uses the DWT cycle counter, and makes every interrupt slightly slower
+//#define COMPOSITE_STATS
+//#define COMPOSITE_STATS_BUCKETS 16//Number of latency histogram buckets
+//#define COMPOSITE_STATS_BUCKET_CYCLES 8//Cycles of latency per bucket
+
+/* Derived Constants */
+#ifndef COMPOSITE_LINE_DIVISOR
+    #define COMPOSITE_LINE_DIVISOR 1
+#endif
+
+#ifdef COMPOSITE_TEXT_MODE
+    #define COMPOSITE_LINE_RENDERER
+#endif
+
+#ifndef COMPOSITE_LINE_BUFFERS
+    #define COMPOSITE_LINE_BUFFERS 2
+#endif
+
+#if defined(COMPOSITE_LINE_TABLE) && defined(COMPOSITE_LINE_RENDERER)
+    #error "COMPOSITE_LINE_TABLE and COMPOSITE_LINE_RENDERER can't be used together"
+#endif
+
+#if defined(COMPOSITE_PROGRESSIVE) && defined(COMPOSITE_INTERLACING)
+    #error "COMPOSITE_PROGRESSIVE fields are drawn on top of each other, so they can't be interlaced"
+#endif
+
+#ifdef COMPOSITE_PAL
+    #define COMPOSITE_VISIBLE_LINES 288//Lines drawn in each field (before COMPOSITE_LINE_DIVISOR)
+#else
+    #define COMPOSITE_VISIBLE_LINES 242//Lines drawn in each field (before COMPOSITE_LINE_DIVISOR)
+#endif
+#define COMPOSITE_FIELD_LINES ((COMPOSITE_VISIBLE_LINES + (COMPOSITE_LINE_DIVISOR - 1)) / COMPOSITE_LINE_DIVISOR)
+#ifdef COMPOSITE_INTERLACING
+    #define COMPOSITE_LINES (COMPOSITE_FIELD_LINES * 2)//Number of lines in the image
+#else
+    #define COMPOSITE_LINES COMPOSITE_FIELD_LINES//Number of lines in the image
+#endif
+
+#define COMPOSITE_TEXT_COLUMNS COMPOSITE_BYTES_PER_LINE//Characters across in text mode
+#define COMPOSITE_TEXT_ROWS (COMPOSITE_LINES / 8)//Characters down in text mode
+
+#ifndef COMPOSITE_STATS_BUCKETS
+    #define COMPOSITE_STATS_BUCKETS 16
+#endif
+
+#ifndef COMPOSITE_STATS_BUCKET_CYCLES
+    #define COMPOSITE_STATS_BUCKET_CYCLES 8
+#endif
+
+#define COMPOSITE_SPRITE_OR 0//Set bits of the sprite's bitmap set pixels
+#define COMPOSITE_SPRITE_XOR 1//Set bits of the sprite's bitmap invert pixels
+
+//Interrupts (TIM4 ones are named by their TIM4_SR flag) for Composite_getStats
+#define COMPOSITE_STAT_UPDATE 0//Not with hardware sync
+#define COMPOSITE_STAT_CC1 1
+#define COMPOSITE_STAT_CC2 2
+#define COMPOSITE_STAT_CC3 3//Not with hardware sync or COMPOSITE_DMA_LINE_START
+#define COMPOSITE_STAT_PENDSV 4//Latency is from the end of the TIM4 ISR before it
+#define COMPOSITE_STAT_INTERRUPTS 5
+
+//Step classes for Composite_getStats
+#define COMPOSITE_STAT_VBLANK 0//Vertical sync (half line) steps
+#define COMPOSITE_STAT_BLANK 1//Lines that aren't drawn
+#define COMPOSITE_STAT_VISIBLE 2//Lines that are drawn
+#define COMPOSITE_STAT_CLASSES 3
+
+#ifdef COMPOSITE_STATS
+typedef struct
+{
+    uint32_t count;//Number of interrupts recorded (everything else is 0 if this is)
+    uint32_t minCycles;//Cycles from entering to leaving the interrupt
+    uint32_t maxCycles;
+    uint32_t meanCycles;
+    uint32_t minLatency;//Cycles from the timer event to entering the interrupt
+    uint32_t maxLatency;
+    uint32_t meanLatency;
+    uint32_t latencyHistogram[COMPOSITE_STATS_BUCKETS];//Last bucket also counts anything later
+} Composite_stats_t;
+#endif
+
 /* Public functions */
-void Composite_init(const uint8_t* fb);//Pointer to framebuffer
-void Composite_setFramebuffer(const uint8_t* fb);//Pointer to framebuffer; use for double buffering
+void Composite_init(const uint8_t* fb);//Pointer to framebuffer (unused in line renderer mode)
 uint_fast16_t Composite_getCurrentStep();//Can help with screen tearing
+uint_fast16_t Composite_getCurrentLine();//Line of the image being drawn; COMPOSITE_LINES if none (blanking)
+
+#ifndef COMPOSITE_LINE_RENDERER
+void Composite_setFramebuffer(const uint8_t* fb);//Pointer to framebuffer; use for double buffering
+
+//Tear-free presenting: the new framebuffer/scroll is latched at the start of the next vblank
+//that precedes a complete image (every field, or only before field 1 when interlacing)
+bool Composite_isPresentPending();//True until the last present has taken effect
+void Composite_waitForPresent();//Sleeps until the last present has taken effect
+#endif
+
+//Beam callbacks (0 to disable). They are run from the PendSV interrupt at the lowest priority,
+//after the TIM4 ISR that detected the event, so they can't disturb the video signal. A callback
+//that runs longer than a line will however delay later callbacks. field is 1 or 2
+//With line buffers (COMPOSITE_LINE_RENDERER, COMPOSITE_TEXT_MODE or COMPOSITE_SPRITES), lines are
+//rendered by the same PendSV interrupt, so none are rendered while a callback runs. The vblank and
+//field end callbacks must return before the first line of the image is drawn (the rest of vblank),
+//and a line callback within COMPOSITE_LINE_BUFFERS - 1 lines, less the time taken to render the
+//lines queued up behind them, or lines are drawn before they are rendered and the image is
+//corrupted. Do long work (like drawing into a framebuffer) from the main loop instead, for
+//example woken up by a vblank callback that only sets a flag
+void Composite_setVBlankCallback(void (*callback)(uint_fast8_t field));//Start of field's vblank
+void Composite_setFieldEndCallback(void (*callback)(uint_fast8_t field));//Last line of field drawn
+void Composite_setLineCallback(uint_fast16_t line, void (*callback)(uint_fast8_t field));//Line of field reached
+
+#ifdef COMPOSITE_LINE_TABLE
+void Composite_setLine(uint_fast16_t line, const uint8_t* address);//Line of image to read from address
+const uint8_t* Composite_getLine(uint_fast16_t line);//Address the line of image is read from
+void Composite_setScroll(uint_fast16_t firstLine);//Table entry shown as the top line of the image
+void Composite_presentScroll(uint_fast16_t firstLine);//Like Composite_setScroll, but tear-free
+#elif defined(COMPOSITE_TEXT_MODE)
+void Composite_setFont(const uint8_t font[128][8]);//8x8 and in ASCII order; W on black
+void Composite_setChar(uint_fast8_t column, uint_fast8_t row, char c);
+void Composite_drawText(uint_fast8_t column, uint_fast8_t row, const char* string);//Wraps
+uint8_t* Composite_getTileMap();//[COMPOSITE_TEXT_ROWS][COMPOSITE_TEXT_COLUMNS]; for bulk writes
+#elif defined(COMPOSITE_LINE_RENDERER)
+//Fills buffer (COMPOSITE_BYTES_PER_LINE bytes) with line of the image (0 to COMPOSITE_LINES - 1)
+//Called from PendSV; must finish within COMPOSITE_LINE_BUFFERS - 1 lines, including the time taken
+//by any beam callbacks run in between (see above)
+void Composite_setLineRenderer(void (*renderer)(uint_fast16_t line, uint8_t* buffer));
+#else
+void Composite_present(const uint8_t* fb);//Like Composite_setFramebuffer, but tear-free
+#endif
+
+#ifdef COMPOSITE_SPRITES
+//bitmap and mask are widthBytes * height bytes, row by row. Mask bits clear pixels before the
+//bitmap is drawn with mode (COMPOSITE_SPRITE_OR/XOR). mask may be 0, bitmap 0 hides the sprite
+void Composite_setSprite(uint_fast8_t sprite, const uint8_t* bitmap, const uint8_t* mask,
+                         uint_fast8_t widthBytes, uint_fast16_t height, uint_fast8_t mode);
+void Composite_moveSprite(uint_fast8_t sprite, int_fast16_t x, uint_fast16_t y);//Top left; x can be < 0
+#endif
+
+#ifdef COMPOSITE_STATS
+//Copies the stats of interrupt (COMPOSITE_STAT_*) during steps of stepClass since the last reset
+void Composite_getStats(uint_fast8_t interrupt, uint_fast8_t stepClass, Composite_stats_t* stats);
+void Composite_resetStats();
+#endif
 
 #endif//COMPOSITE_H
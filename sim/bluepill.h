@@ -0,0 +1,118 @@
+/* Stand-in for bluepill.h that lets composite.c (and softrenderer.c) be built and run on a host
+ * Every register is a word of simulated memory (see sim.c) found from its physical address, so code
+ * using a literal address (like DMA_CPAR3 = 0x4001300C) works too. Accessing a register from an
+ * interrupt costs simulated time, and applies the side effects of the last access (like the
+ * BSRR/BRR writes that move a pin). See sim.h for how to build and run the simulator
+*/
+
+#ifndef BLUEPILL_H
+#define BLUEPILL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+/* Simulator hooks (not part of the real bluepill.h) */
+volatile uint32_t* Sim_access(uint32_t address);//Register at address (after the cost of a bus access)
+void Sim_delay(uint64_t cycles);//Lets time pass (interrupts keep running)
+
+#define SIM_REGISTER(address) (*Sim_access(address))
+
+//Interrupt handlers are called like any other function; the ARM attribute means nothing on a host
+#define interrupt(type)
+
+void __ISR_TIM4();
+void __ISR_PendSV();
+
+/* Registers */
+//GPIO
+#define GPIOA_CRL SIM_REGISTER(0x40010800)
+#define GPIOA_CRH SIM_REGISTER(0x40010804)
+#define GPIOA_IDR SIM_REGISTER(0x40010808)
+#define GPIOA_ODR SIM_REGISTER(0x4001080C)
+#define GPIOA_BSRR SIM_REGISTER(0x40010810)
+#define GPIOA_BRR SIM_REGISTER(0x40010814)
+#define GPIOB_CRL SIM_REGISTER(0x40010C00)
+#define GPIOB_CRH SIM_REGISTER(0x40010C04)
+#define GPIOB_IDR SIM_REGISTER(0x40010C08)
+#define GPIOB_ODR SIM_REGISTER(0x40010C0C)
+#define GPIOB_BSRR SIM_REGISTER(0x40010C10)
+#define GPIOB_BRR SIM_REGISTER(0x40010C14)
+
+//SPI1
+#define SPI1_CR1 SIM_REGISTER(0x40013000)
+#define SPI1_CR2 SIM_REGISTER(0x40013004)
+#define SPI1_SR SIM_REGISTER(0x40013008)
+#define SPI1_DR SIM_REGISTER(0x4001300C)
+
+//DMA1 (channels are 20 bytes apart)
+#define DMA_ISR SIM_REGISTER(0x40020000)
+#define DMA_IFCR SIM_REGISTER(0x40020004)
+#define DMA_CCR1 SIM_REGISTER(0x40020008)
+#define DMA_CNDTR1 SIM_REGISTER(0x4002000C)
+#define DMA_CPAR1 SIM_REGISTER(0x40020010)
+#define DMA_CMAR1 SIM_REGISTER(0x40020014)
+#define DMA_CCR2 SIM_REGISTER(0x4002001C)
+#define DMA_CNDTR2 SIM_REGISTER(0x40020020)
+#define DMA_CPAR2 SIM_REGISTER(0x40020024)
+#define DMA_CMAR2 SIM_REGISTER(0x40020028)
+#define DMA_CCR3 SIM_REGISTER(0x40020030)
+#define DMA_CNDTR3 SIM_REGISTER(0x40020034)
+#define DMA_CPAR3 SIM_REGISTER(0x40020038)
+#define DMA_CMAR3 SIM_REGISTER(0x4002003C)
+#define DMA_CCR4 SIM_REGISTER(0x40020044)
+#define DMA_CNDTR4 SIM_REGISTER(0x40020048)
+#define DMA_CPAR4 SIM_REGISTER(0x4002004C)
+#define DMA_CMAR4 SIM_REGISTER(0x40020050)
+#define DMA_CCR5 SIM_REGISTER(0x40020058)
+#define DMA_CNDTR5 SIM_REGISTER(0x4002005C)
+#define DMA_CPAR5 SIM_REGISTER(0x40020060)
+#define DMA_CMAR5 SIM_REGISTER(0x40020064)
+#define DMA_CCR6 SIM_REGISTER(0x4002006C)
+#define DMA_CNDTR6 SIM_REGISTER(0x40020070)
+#define DMA_CPAR6 SIM_REGISTER(0x40020074)
+#define DMA_CMAR6 SIM_REGISTER(0x40020078)
+#define DMA_CCR7 SIM_REGISTER(0x40020080)
+#define DMA_CNDTR7 SIM_REGISTER(0x40020084)
+#define DMA_CPAR7 SIM_REGISTER(0x40020088)
+#define DMA_CMAR7 SIM_REGISTER(0x4002008C)
+
+//TIM4
+#define TIM4_CR1 SIM_REGISTER(0x40000800)
+#define TIM4_CR2 SIM_REGISTER(0x40000804)
+#define TIM4_SMCR SIM_REGISTER(0x40000808)
+#define TIM4_DIER SIM_REGISTER(0x4000080C)
+#define TIM4_SR SIM_REGISTER(0x40000810)
+#define TIM4_EGR SIM_REGISTER(0x40000814)
+#define TIM4_CCMR1 SIM_REGISTER(0x40000818)
+#define TIM4_CCMR2 SIM_REGISTER(0x4000081C)
+#define TIM4_CCER SIM_REGISTER(0x40000820)
+#define TIM4_CNT SIM_REGISTER(0x40000824)
+#define TIM4_PSC SIM_REGISTER(0x40000828)
+#define TIM4_ARR SIM_REGISTER(0x4000082C)
+#define TIM4_CCR1 SIM_REGISTER(0x40000834)
+#define TIM4_CCR2 SIM_REGISTER(0x40000838)
+#define TIM4_CCR3 SIM_REGISTER(0x4000083C)
+#define TIM4_CCR4 SIM_REGISTER(0x40000840)
+#define TIM4_DCR SIM_REGISTER(0x40000848)
+#define TIM4_DMAR SIM_REGISTER(0x4000084C)
+
+//RCC (clocks are always on in the simulator)
+#define RCC_AHBENR SIM_REGISTER(0x40021014)
+#define RCC_APB2ENR SIM_REGISTER(0x40021018)
+#define RCC_APB1ENR SIM_REGISTER(0x4002101C)
+
+//Core
+#define NVIC_ISER0 SIM_REGISTER(0xE000E100)
+#define NVIC_ICER0 SIM_REGISTER(0xE000E180)
+#define SCB_ICSR SIM_REGISTER(0xE000ED04)
+#define SCB_SHPR3 SIM_REGISTER(0xE000ED20)
+#define DEMCR SIM_REGISTER(0xE000EDFC)
+#define DWT_CTRL SIM_REGISTER(0xE0001000)
+#define DWT_CYCCNT SIM_REGISTER(0xE0001004)
+
+/* Functions */
+static inline void __nop() {}
+static inline void __delayInstructions(uint32_t count) {Sim_delay(count);}//About a cycle each
+
+#endif//BLUEPILL_H
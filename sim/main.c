@@ -0,0 +1,189 @@
+//Runs composite.c in the simulator and captures what it outputs (see sim.h)
+//Draws a test image like test.c does, lets a few frames pass so everything has settled, then
+//writes the next frame(s) as a PGM image and a per line timing log, and prints a summary
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "bluepill.h"
+#include "composite.h"
+#include "softrenderer.h"
+#include "bitmaps/vincent.h"
+#include "sim.h"
+
+//              y, x
+uint8_t ramFB[COMPOSITE_LINES][59];//Same as test.c
+
+static void drawTestImage();
+#if defined(COMPOSITE_LINE_RENDERER) && !defined(COMPOSITE_LINE_TABLE)
+static void renderLine(uint_fast16_t line, uint8_t* buffer);
+#endif
+
+int main(int argc, char** argv)
+{
+    uint32_t frames = 1, skip = 2, cyclesPerPixel = 4;
+    const char* imagePath = "frame.pgm";
+    const char* logPath = 0;
+    const char* edgePath = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "f:s:c:o:l:e:")) != -1)
+    {
+        switch (option)
+        {
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 's':
+                skip = atoi(optarg);
+                break;
+            case 'c':
+                cyclesPerPixel = atoi(optarg);
+                break;
+            case 'o':
+                imagePath = optarg;
+                break;
+            case 'l':
+                logPath = optarg;
+                break;
+            case 'e':
+                edgePath = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f frames] [-s frames to skip] [-c cycles per pixel] [-o image.pgm] [-l lines.csv] [-e edges.csv]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (!frames || !cyclesPerPixel)
+    {
+        fprintf(stderr, "Frames and cycles per pixel must be at least 1\n");
+        return 1;
+    }
+
+    //DMA addresses are 32 bits, like on the board
+    if ((uintptr_t)ramFB > UINT32_MAX)
+    {
+        fprintf(stderr, "Static data is above 4GiB; build with -no-pie\n");
+        return 1;
+    }
+
+    drawTestImage();
+
+    //A frame is 2 fields, and one more makes sure the last one is complete
+    Sim_run((uint64_t)(skip + frames + 1) * SIM_FRAME_LINES * SIM_LINE_CYCLES);
+
+    uint32_t lineCount;
+    const Sim_line_t* const lines = Sim_getLines(&lineCount);
+
+    //Skip the fields that are settling
+    uint32_t first = Sim_findField(0);
+    for (uint32_t i = 0; (i < (skip * 2)) && (first < lineCount); ++i)
+        first = Sim_findField(first + 1);
+
+    uint32_t last = first;
+    for (uint32_t i = 0; (i < (frames * 2)) && (last < lineCount); ++i)
+        last = Sim_findField(last + 1);
+
+    if ((first >= lineCount) || (last >= lineCount))
+    {
+        fprintf(stderr, "No vertical sync found (%u lines in %llu cycles)\n", lineCount, (unsigned long long)Sim_getCycles());
+        return 1;
+    }
+
+    if (!Sim_writePGM(imagePath, first, last, cyclesPerPixel))
+    {
+        fprintf(stderr, "Couldn't write %s\n", imagePath);
+        return 1;
+    }
+
+    if (logPath && !Sim_writeLineLog(logPath, first, last))
+    {
+        fprintf(stderr, "Couldn't write %s\n", logPath);
+        return 1;
+    }
+
+    if (edgePath && !Sim_writeEdges(edgePath, first, last))
+    {
+        fprintf(stderr, "Couldn't write %s\n", edgePath);
+        return 1;
+    }
+
+    //Summary
+    uint64_t interruptCycles = 0;
+    uint32_t interrupts = 0, maxLatency = 0, fieldStart = first, field = 0;
+    for (uint32_t i = first; i <= last; ++i)
+    {
+        if ((i == last) || ((i != first) && lines[i].vsync && !lines[i - 1].vsync))
+        {
+            printf("Field %u: %u lines\n", field++, i - fieldStart);
+            fieldStart = i;
+        }
+
+        if (i == last)
+            break;
+
+        interrupts += lines[i].interrupts;
+        interruptCycles += lines[i].interruptCycles;
+        if (lines[i].maxLatency > maxLatency)
+            maxLatency = lines[i].maxLatency;
+    }
+
+    const uint64_t cycles = lines[last].start - lines[first].start;
+    printf("%u interrupts, %.2f%% of the cpu, longest TIM4 latency %u cycles\n", interrupts,
+           (100.0 * interruptCycles) / cycles, maxLatency);
+    printf("Wrote %s (%u by %u)\n", imagePath, SIM_LINE_CYCLES / cyclesPerPixel, last - first);
+
+    return 0;
+}
+
+#if defined(COMPOSITE_TEXT_MODE)
+static void drawTestImage()
+{
+    Composite_setFont(vincentFont);
+    Composite_init(0);
+
+    Composite_drawText(1, 1, "Hello World!");
+    Composite_drawText(1, 3, "Composite simulator text mode");
+    for (uint_fast8_t row = 5; row < COMPOSITE_TEXT_ROWS; ++row)
+        Composite_setChar(row, row, '#');
+}
+#elif defined(COMPOSITE_LINE_RENDERER) && !defined(COMPOSITE_LINE_TABLE)
+static void drawTestImage()
+{
+    Composite_setLineRenderer(renderLine);
+    Composite_init(0);
+}
+
+//Diagonal bars
+static void renderLine(uint_fast16_t line, uint8_t* buffer)
+{
+    for (uint_fast16_t x = 0; x < COMPOSITE_BYTES_PER_LINE; ++x)
+        buffer[x] = ((x + (line / 8)) & 1) ? 0xFF : 0x00;
+}
+#else
+static void drawTestImage()
+{
+    #if (COMPOSITE_BYTES_PER_LINE == 59) && !defined(COMPOSITE_INTERLACING)
+    //The same kind of thing as test.c's demo
+    SR_setFrameBuffer((uint8_t*)ramFB);
+    SR_setCharacterRom(vincentFont);
+
+    SR_drawText(1, 8, "Hello World!");
+    SR_drawText(13, 72, "Software Rendering+Composite Demo!");
+    SR_drawRectangle(0, 0, SR_BYTES_PER_LINE * 8, SR_LINES);
+    SR_drawLine(8, 100, 460, 230);
+    SR_drawRectangle_F(200, 120, 100, 50);
+    Composite_init((uint8_t*)ramFB);
+    #else
+    //Other resolutions need a bigger framebuffer than softrenderer.h is set up for
+    static uint8_t fb[COMPOSITE_LINES][COMPOSITE_BYTES_PER_LINE];
+    for (uint_fast16_t y = 0; y < COMPOSITE_LINES; ++y)
+    {
+        for (uint_fast16_t x = 0; x < COMPOSITE_BYTES_PER_LINE; ++x)
+            fb[y][x] = ((x + (y / 8)) & 1) ? 0xFF : 0x00;
+    }
+    Composite_init((uint8_t*)fb);
+    #endif
+}
+#endif
@@ -0,0 +1,846 @@
+/* Host simulator of the TIM4/SPI1/DMA video pipeline (see sim.h) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bluepill.h"
+#include "sim.h"
+
+/* Register Memory */
+//Each peripheral is a block of words at its physical address
+static volatile uint32_t tim4[256], gpioa[256], gpiob[256], spi1[256], dma1[256], rcc[256], dwt[256];
+static volatile uint32_t scs[1024];//System control space (NVIC and SCB)
+
+typedef struct
+{
+    uint32_t base;
+    uint32_t words;
+    volatile uint32_t* memory;
+} block_t;
+
+static const block_t blocks[] =
+{
+    {0x40000800, 256, tim4}, {0x40010800, 256, gpioa}, {0x40010C00, 256, gpiob},
+    {0x40013000, 256, spi1}, {0x40020000, 256, dma1}, {0x40021000, 256, rcc},
+    {0xE0001000, 256, dwt}, {0xE000E000, 1024, scs}
+};
+#define BLOCKS (sizeof(blocks) / sizeof(blocks[0]))
+
+//Word offsets within a block
+#define GPIO_CRL 0
+#define GPIO_CRH 1
+#define GPIO_ODR 3
+#define GPIO_BSRR 4
+#define GPIO_BRR 5
+#define SPI_CR1 0
+#define SPI_CR2 1
+#define SPI_SR 2
+#define SPI_DR 3
+#define DMA_STATUS 0
+#define DMA_FLAG_CLEAR 1
+#define DMA_CCR(channel) (2 + (5 * ((channel) - 1)))
+#define DMA_CNDTR(channel) (DMA_CCR(channel) + 1)
+#define DMA_CPAR(channel) (DMA_CCR(channel) + 2)
+#define DMA_CMAR(channel) (DMA_CCR(channel) + 3)
+#define TIM_CR1 0
+#define TIM_DIER 3
+#define TIM_SR 4
+#define TIM_EGR 5
+#define TIM_CCMR1 6
+#define TIM_CCMR2 7
+#define TIM_CCER 8
+#define TIM_CNT 9
+#define TIM_PSC 10
+#define TIM_ARR 11
+#define TIM_CCR(channel) (12 + (channel))
+#define TIM_DCR 18
+#define TIM_DMAR 19
+#define NVIC_ISER (0x100 / 4)
+#define NVIC_ICER (0x180 / 4)
+#define NVIC_IPR (0x400 / 4)
+#define SCB_ICSR_WORD (0xD04 / 4)
+#define SCB_SHPR3_WORD (0xD20 / 4)
+#define DWT_CTRL_WORD 0
+#define DWT_CYCCNT_WORD 1
+
+//Bits
+#define SPI_CR1_SPE (1 << 6)
+#define SPI_CR2_TXDMAEN (1 << 1)
+#define DMA_CCR_EN (1 << 0)
+#define DMA_CCR_DIR (1 << 4)//Memory to peripheral
+#define DMA_CCR_CIRC (1 << 5)
+#define DMA_CCR_PINC (1 << 6)
+#define DMA_CCR_MINC (1 << 7)
+#define TIM_CR1_CEN (1 << 0)
+#define TIM_CR1_ARPE (1 << 7)
+#define TIM_DIER_UDE (1 << 8)
+#define TIM_INTERRUPTS 0x5F//Flags in TIM_SR that can cause an interrupt
+#define ICSR_PENDSVSET (1 << 28)
+#define ICSR_PENDSVCLR (1 << 27)
+#define THREAD_PRIORITY 0x100//Lower than any exception
+
+/* State */
+static uint64_t now = 0;//Cycles since the start
+static uint_fast16_t priority = THREAD_PRIORITY;//Current execution priority
+static uint_fast8_t depth = 0;//Handlers running (accesses only take time inside them)
+static uint64_t preemptedCycles = 0;//Cycles taken by handlers that preempted the current one
+
+//TIM4 (buffered values loaded from the preload registers at each update event)
+static uint32_t prescalerCount, activePSC, activeARR, activeCCR[4];
+static uint_fast8_t dmarIndex = 0;//Register of the DMAR burst written next
+static bool oc3Latched = false;//Channel 3 reference for the on-match output modes
+static bool timerPending = false;//TIM4 interrupt was pending last cycle
+static uint64_t timerEventCycle;//When it became pending
+
+//SPI1
+static bool spiEnabled = false, txFull = false, mosi = false;
+static uint8_t txData, shift;
+static uint_fast8_t bitsLeft = 0;
+static uint32_t bitCycle = 0;
+
+//DMA1 (channel 0 unused); the addresses and count are latched when a channel is enabled, and
+//circular channels go back to those
+typedef struct
+{
+    bool enabled;
+    uint32_t memory;
+    uint32_t peripheral;
+    uint32_t count;
+    uint32_t reloadCount;
+} channel_t;
+static channel_t channels[8];
+
+//NVIC
+static uint32_t nvicEnabled = 0;
+static bool pendSVPending = false;
+static uint64_t pendSVCycle;
+
+//Recording
+static Sim_edge_t* edges = 0;
+static uint32_t edgeCount = 0, edgeCapacity = 0;
+static uint8_t level = 0xFF;//Last recorded level (none yet)
+static Sim_interrupt_t* interrupts = 0;
+static uint32_t interruptCount = 0, interruptCapacity = 0;
+static Sim_line_t* lines = 0;
+static uint32_t lineCount = 0;
+
+/* Private Functions */
+static volatile uint32_t* registerAt(uint32_t address);
+static uint32_t addressOf(volatile const void* pointer);
+static void* grow(void* array, uint32_t count, uint32_t* capacity, size_t size);
+static void commit();
+static void writeRegister(uint32_t address, uint32_t value);
+static void dmaRequest(uint_fast8_t channel);
+static void updateEvent(bool resetCounter);
+static void timerTick();
+static bool timerOutput3();
+static void spiTick();
+static bool pin(volatile uint32_t* port, uint_fast8_t number, bool alternate);
+static void tick();
+static uint_fast16_t exceptionPriority(uint_fast8_t exception);
+static uint_fast8_t pendingException(uint_fast16_t threshold);
+static void takeException(uint_fast8_t exception);
+static void advance(uint32_t cycles);
+static uint8_t levelAt(uint64_t cycle);
+
+/* Public Functions */
+
+//Hooks for bluepill.h
+volatile uint32_t* Sim_access(uint32_t address)
+{
+    commit();//Whatever the last access did happens now
+
+    if (depth)
+        advance(SIM_ACCESS_CYCLES);
+
+    return registerAt(address);
+}
+
+void Sim_delay(uint64_t cycles)
+{
+    if (depth)
+        advance(cycles);
+    else
+        Sim_run(cycles);
+}
+
+//Old versions don't all have a PendSV handler
+__attribute__ ((weak)) void __ISR_PendSV() {}
+
+void Sim_run(uint64_t cycles)
+{
+    commit();//The last write from the main program
+
+    const uint64_t end = now + cycles;
+    while (now < end)
+    {
+        const uint_fast8_t exception = pendingException(THREAD_PRIORITY);
+        if (exception)
+            takeException(exception);
+        else
+            tick();
+    }
+}
+
+uint64_t Sim_getCycles()
+{
+    return now;
+}
+
+const Sim_edge_t* Sim_getEdges(uint32_t* count)
+{
+    *count = edgeCount;
+    return edges;
+}
+
+const Sim_interrupt_t* Sim_getInterrupts(uint32_t* count)
+{
+    *count = interruptCount;
+    return interrupts;
+}
+
+const Sim_line_t* Sim_getLines(uint32_t* count)
+{
+    //Like a monitor's horizontal sync: a sync pulse starts a new line unless it is less than 3/4
+    //of a line after the start of the last one (equalising/serration pulses), and if there's no
+    //sync for too long, lines carry on at the nominal length (flywheel)
+    free(lines);
+    lines = 0;
+    lineCount = 0;
+    uint32_t capacity = 0;
+
+    Sim_line_t* line = 0;
+    uint32_t nextInterrupt = 0;
+
+    for (uint32_t i = 0; i < edgeCount; ++i)
+    {
+        const uint64_t cycle = edges[i].cycle;
+        const uint64_t end = ((i + 1) < edgeCount) ? edges[(i + 1)].cycle : now;
+
+        //Lines the flywheel fills in before this edge
+        while (line && ((cycle - line->start) > ((SIM_LINE_CYCLES * 3) / 2)))
+        {
+            const uint64_t start = line->start + SIM_LINE_CYCLES;
+            lines = grow(lines, lineCount, &capacity, sizeof(Sim_line_t));
+            line = &lines[lineCount++];
+            *line = (Sim_line_t) {.start = start, .videoStart = -1};
+        }
+
+        if (edges[i].level == SIM_SYNC)
+        {
+            if (!line || ((cycle - line->start) >= ((SIM_LINE_CYCLES * 3) / 4)))
+            {
+                lines = grow(lines, lineCount, &capacity, sizeof(Sim_line_t));
+                line = &lines[lineCount++];
+                *line = (Sim_line_t) {.start = cycle, .videoStart = -1};
+            }
+
+            if (!line->syncPulses)
+                line->syncWidth = end - cycle;
+            if ((end - cycle) > (SIM_LINE_CYCLES / 4))
+                line->vsync = true;
+
+            ++line->syncPulses;
+        }
+        else if (line && (edges[i].level == SIM_WHITE))
+        {
+            if (line->videoStart < 0)
+                line->videoStart = cycle - line->start;
+            line->videoEnd = end - line->start;
+        }
+    }
+
+    for (uint32_t i = 0; i < lineCount; ++i)
+    {
+        line = &lines[i];
+        line->length = (((i + 1) < lineCount) ? lines[i + 1].start : now) - line->start;
+
+        //Interrupts that started during the line (both are in order)
+        while ((nextInterrupt < interruptCount) && (interrupts[nextInterrupt].entry < line->start))
+            ++nextInterrupt;
+
+        for (; (nextInterrupt < interruptCount) && (interrupts[nextInterrupt].entry < (line->start + line->length)); ++nextInterrupt)
+        {
+            const Sim_interrupt_t* const interrupt = &interrupts[nextInterrupt];
+            ++line->interrupts;
+            line->interruptCycles += interrupt->cycles;
+
+            if ((interrupt->exception == SIM_TIM4) && (interrupt->latency > line->maxLatency))
+                line->maxLatency = interrupt->latency;
+        }
+    }
+
+    *count = lineCount;
+    return lines;
+}
+
+uint32_t Sim_findField(uint32_t line)
+{
+    for (; line < lineCount; ++line)
+    {
+        if (lines[line].vsync && (!line || !lines[line - 1].vsync))
+            return line;
+    }
+
+    return lineCount;
+}
+
+bool Sim_writePGM(const char* path, uint32_t first, uint32_t last, uint32_t cyclesPerPixel)
+{
+    static const uint8_t grey[3] = {0, 77, 255};//0v, 0.3v and 1v
+
+    FILE* const file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    const uint32_t width = SIM_LINE_CYCLES / cyclesPerPixel;
+    fprintf(file, "P5\n%u %u\n255\n", width, last - first);
+
+    for (uint32_t i = first; i < last; ++i)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+            fputc(grey[levelAt(lines[i].start + (x * cyclesPerPixel))], file);
+    }
+
+    return !fclose(file);
+}
+
+bool Sim_writeLineLog(const char* path, uint32_t first, uint32_t last)
+{
+    FILE* const file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    #define US(cycles) ((double)(cycles) * 1000000 / SIM_CLOCK)
+    fprintf(file, "line,field,start_cycle,length_us,sync_us,sync_pulses,vsync,video_start_us,video_end_us,interrupts,interrupt_cycles,max_latency_cycles\n");
+
+    uint32_t field = 0;
+    for (uint32_t i = first; i < last; ++i)
+    {
+        const Sim_line_t* const line = &lines[i];
+        if ((i != first) && line->vsync && !lines[i - 1].vsync)
+            ++field;
+
+        fprintf(file, "%u,%u,%llu,%.3f,%.3f,%u,%u,", i - first, field, (unsigned long long)line->start,
+                US(line->length), US(line->syncWidth), line->syncPulses, line->vsync);
+
+        if (line->videoStart >= 0)
+            fprintf(file, "%.3f,%.3f,", US(line->videoStart), US(line->videoEnd));
+        else
+            fprintf(file, ",,");
+
+        fprintf(file, "%u,%u,%u\n", line->interrupts, line->interruptCycles, line->maxLatency);
+    }
+    #undef US
+
+    return !fclose(file);
+}
+
+bool Sim_writeEdges(const char* path, uint32_t first, uint32_t last)
+{
+    FILE* const file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    //Sync is what the monitor sees of PB8 (white hides it, like the diode mixing does)
+    const uint64_t start = lines[first].start;
+    const uint64_t end = (last < lineCount) ? lines[last].start : now;
+    fprintf(file, "Time [s],Sync,Video\n");
+
+    uint32_t i = 0;
+    while ((i < edgeCount) && (edges[i].cycle < start))
+        ++i;
+
+    fprintf(file, "0,%u,%u\n", levelAt(start) != SIM_SYNC, levelAt(start) == SIM_WHITE);
+    for (; (i < edgeCount) && (edges[i].cycle < end); ++i)
+    {
+        if (edges[i].cycle != start)
+            fprintf(file, "%.9f,%u,%u\n", (double)(edges[i].cycle - start) / SIM_CLOCK, edges[i].level != SIM_SYNC, edges[i].level == SIM_WHITE);
+    }
+
+    return !fclose(file);
+}
+
+/* Private Functions */
+
+//Word of register memory at physical address
+static volatile uint32_t* registerAt(uint32_t address)
+{
+    for (uint_fast8_t i = 0; i < BLOCKS; ++i)
+    {
+        if ((address >= blocks[i].base) && (address < (blocks[i].base + (blocks[i].words * 4))))
+            return &blocks[i].memory[(address - blocks[i].base) / 4];
+    }
+
+    fprintf(stderr, "sim: 0x%08X isn't a simulated register\n", address);
+    exit(1);
+}
+
+//Physical address of a pointer into register memory, or 0 if it is ordinary memory
+static uint32_t addressOf(volatile const void* pointer)
+{
+    const uintptr_t host = (uintptr_t)pointer;
+
+    for (uint_fast8_t i = 0; i < BLOCKS; ++i)
+    {
+        const uintptr_t memory = (uintptr_t)blocks[i].memory;
+        if ((host >= memory) && (host < (memory + (blocks[i].words * 4))))
+            return blocks[i].base + (host - memory);
+    }
+
+    return 0;
+}
+
+//Makes room for one more element at the end of array
+static void* grow(void* array, uint32_t count, uint32_t* capacity, size_t size)
+{
+    if (count < *capacity)
+        return array;
+
+    *capacity = *capacity ? (*capacity * 2) : 4096;
+    array = realloc(array, *capacity * size);
+    if (!array)
+    {
+        fprintf(stderr, "sim: out of memory\n");
+        exit(1);
+    }
+
+    return array;
+}
+
+//Applies the side effects of writes to registers. Registers are plain memory, so this is called
+//after every access and compares them with what the peripherals last saw
+static void commit()
+{
+    volatile uint32_t* const ports[2] = {gpioa, gpiob};
+    for (uint_fast8_t i = 0; i < 2; ++i)
+    {
+        volatile uint32_t* const port = ports[i];
+
+        if (port[GPIO_BSRR])
+        {
+            port[GPIO_ODR] = (port[GPIO_ODR] | (port[GPIO_BSRR] & 0xFFFF)) & ~(port[GPIO_BSRR] >> 16);
+            port[GPIO_BSRR] = 0;
+        }
+
+        if (port[GPIO_BRR])
+        {
+            port[GPIO_ODR] &= ~(port[GPIO_BRR] & 0xFFFF);
+            port[GPIO_BRR] = 0;
+        }
+    }
+
+    if (tim4[TIM_EGR] & 1)//Update generation
+        updateEvent(true);
+    tim4[TIM_EGR] = 0;
+
+    const bool enabled = spi1[SPI_CR1] & SPI_CR1_SPE;
+    if (enabled != spiEnabled)
+    {
+        spiEnabled = enabled;
+        bitsLeft = 0;//Anything being shifted out is lost
+    }
+
+    for (uint_fast8_t i = 1; i <= 7; ++i)
+    {
+        channel_t* const channel = &channels[i];
+        const bool channelEnabled = dma1[DMA_CCR(i)] & DMA_CCR_EN;
+
+        if (channelEnabled && !channel->enabled)
+        {
+            channel->memory = dma1[DMA_CMAR(i)];
+            channel->peripheral = dma1[DMA_CPAR(i)];
+            channel->count = dma1[DMA_CNDTR(i)] & 0xFFFF;
+            channel->reloadCount = channel->count;
+        }
+
+        channel->enabled = channelEnabled;
+    }
+
+    dma1[DMA_STATUS] &= ~dma1[DMA_FLAG_CLEAR];
+    dma1[DMA_FLAG_CLEAR] = 0;
+
+    nvicEnabled = (nvicEnabled | scs[NVIC_ISER]) & ~scs[NVIC_ICER];
+    scs[NVIC_ISER] = nvicEnabled;
+    scs[NVIC_ICER] = 0;
+
+    if (scs[SCB_ICSR_WORD] & ICSR_PENDSVSET)
+    {
+        if (!pendSVPending)
+            pendSVCycle = now;
+        pendSVPending = true;
+    }
+    if (scs[SCB_ICSR_WORD] & ICSR_PENDSVCLR)
+        pendSVPending = false;
+    scs[SCB_ICSR_WORD] = 0;
+}
+
+//A write by DMA (registers with side effects of their own are handled here)
+static void writeRegister(uint32_t address, uint32_t value)
+{
+    if (address == (0x40013000 + (SPI_DR * 4)))//Transmit buffer
+    {
+        txData = value;
+        txFull = true;
+        spi1[SPI_DR] = value;
+    }
+    else if (address == (0x40000800 + (TIM_DMAR * 4)))//Next register of the burst
+    {
+        const uint32_t base = tim4[TIM_DCR] & 0x1F;
+        const uint32_t length = ((tim4[TIM_DCR] >> 8) & 0x1F) + 1;
+
+        writeRegister(0x40000800 + ((base + dmarIndex) * 4), value);
+        dmarIndex = (dmarIndex + 1) % length;
+    }
+    else
+    {
+        *registerAt(address) = value;
+        commit();
+    }
+}
+
+//Does one transfer of channel if it is enabled and has anything left to do
+static void dmaRequest(uint_fast8_t channel)
+{
+    channel_t* const state = &channels[channel];
+    if (!state->enabled || !state->count)
+        return;
+
+    const uint32_t config = dma1[DMA_CCR(channel)];
+    const uint32_t memorySize = 1 << ((config >> 10) & 3);
+    const uint32_t peripheralSize = 1 << ((config >> 8) & 3);
+    const bool toPeripheral = config & DMA_CCR_DIR;
+
+    const uint32_t source = toPeripheral ? state->memory : state->peripheral;
+    const uint32_t destination = toPeripheral ? state->peripheral : state->memory;
+    const uint32_t sourceSize = toPeripheral ? memorySize : peripheralSize;
+    const uint32_t destinationSize = toPeripheral ? peripheralSize : memorySize;
+
+    //Addresses in the peripheral/system regions are registers, anything else is host memory
+    //(static data is below 4GiB with -no-pie, so 32 bit addresses of it still work)
+    const bool sourceIsRegister = (source >= 0x40000000) && ((source < 0x60000000) || (source >= 0xE0000000));
+    volatile const uint8_t* const from = sourceIsRegister ? (volatile const uint8_t*)registerAt(source & ~3) : (const uint8_t*)(uintptr_t)source;
+    uint32_t value = 0;
+    memcpy(&value, (const void*)from, sourceSize);
+    if (destinationSize < 4)
+        value &= (1u << (destinationSize * 8)) - 1;
+
+    const bool destinationIsRegister = (destination >= 0x40000000) && ((destination < 0x60000000) || (destination >= 0xE0000000));
+    const uint32_t registerAddress = destinationIsRegister ? (destination & ~3) : addressOf((const void*)(uintptr_t)destination);
+    if (registerAddress)
+        writeRegister(registerAddress & ~3, value);
+    else
+        memcpy((void*)(uintptr_t)destination, &value, destinationSize);
+
+    if (config & DMA_CCR_MINC)
+        state->memory += memorySize;
+    if (config & DMA_CCR_PINC)
+        state->peripheral += peripheralSize;
+
+    if (!--state->count)
+    {
+        dma1[DMA_STATUS] |= 0x3 << (4 * (channel - 1));//Transfer complete and global flags
+
+        if (config & DMA_CCR_CIRC)
+        {
+            state->memory = dma1[DMA_CMAR(channel)];
+            state->peripheral = dma1[DMA_CPAR(channel)];
+            state->count = state->reloadCount;
+        }
+    }
+
+    dma1[DMA_CNDTR(channel)] = state->count;//Counts down while the channel runs
+}
+
+//Loads the buffered registers and sets the update flag (from overflow or the UG bit)
+static void updateEvent(bool resetCounter)
+{
+    if (resetCounter)
+    {
+        tim4[TIM_CNT] = 0;
+        prescalerCount = 0;
+    }
+
+    activePSC = tim4[TIM_PSC] & 0xFFFF;
+    activeARR = tim4[TIM_ARR] & 0xFFFF;
+    for (uint_fast8_t i = 0; i < 4; ++i)
+        activeCCR[i] = tim4[TIM_CCR(i + 1)] & 0xFFFF;
+
+    tim4[TIM_SR] |= 1;
+
+    if (tim4[TIM_DIER] & TIM_DIER_UDE)//Channel 7 (TIM4_UP); a DMAR burst is one request per register
+    {
+        const bool burst = (dma1[DMA_CPAR(7)] == (0x40000800 + (TIM_DMAR * 4))) ||
+                           (addressOf((const void*)(uintptr_t)dma1[DMA_CPAR(7)]) == (0x40000800 + (TIM_DMAR * 4)));
+        const uint32_t requests = burst ? (((tim4[TIM_DCR] >> 8) & 0x1F) + 1) : 1;
+
+        for (uint32_t i = 0; i < requests; ++i)
+            dmaRequest(7);
+    }
+}
+
+//One cycle of TIM4 (clocked at SIM_CLOCK through its prescaler)
+static void timerTick()
+{
+    if (!(tim4[TIM_CR1] & TIM_CR1_CEN))
+        return;
+
+    if (prescalerCount < activePSC)
+    {
+        ++prescalerCount;
+        return;
+    }
+    prescalerCount = 0;
+
+    const uint32_t reload = (tim4[TIM_CR1] & TIM_CR1_ARPE) ? activeARR : (tim4[TIM_ARR] & 0xFFFF);
+    uint32_t count = tim4[TIM_CNT] & 0xFFFF;
+    if (count >= reload)
+    {
+        count = 0;
+        tim4[TIM_CNT] = 0;
+        updateEvent(false);
+    }
+    else
+        tim4[TIM_CNT] = ++count;
+
+    //Compare matches (the compare registers are buffered if their OCxPE bit is set)
+    static const uint_fast8_t dmaChannels[4] = {1, 4, 5, 0};//TIM4_CH1 to TIM4_CH4 requests
+    for (uint_fast8_t i = 0; i < 4; ++i)
+    {
+        const uint32_t mode = (i < 2) ? (tim4[TIM_CCMR1] >> (8 * i)) : (tim4[TIM_CCMR2] >> (8 * (i - 2)));
+        const uint32_t compare = (mode & (1 << 3)) ? activeCCR[i] : (tim4[TIM_CCR(i + 1)] & 0xFFFF);
+
+        if (count == compare)
+        {
+            tim4[TIM_SR] |= 2 << i;
+
+            if ((tim4[TIM_DIER] & (0x200 << i)) && dmaChannels[i])
+                dmaRequest(dmaChannels[i]);
+
+            if (i == 2)//Output modes that act on a match
+            {
+                const uint32_t outputMode = (mode >> 4) & 7;
+                if (outputMode == 1)
+                    oc3Latched = true;
+                else if (outputMode == 2)
+                    oc3Latched = false;
+                else if (outputMode == 3)
+                    oc3Latched = !oc3Latched;
+            }
+        }
+    }
+}
+
+//Level of TIM4_CH3 (PB8 when it is an alternate function output)
+static bool timerOutput3()
+{
+    if (!(tim4[TIM_CCER] & (1 << 8)))
+        return false;//Output disabled
+
+    const uint32_t mode = tim4[TIM_CCMR2];
+    const uint32_t compare = (mode & (1 << 3)) ? activeCCR[2] : (tim4[TIM_CCR(3)] & 0xFFFF);
+    const uint32_t count = tim4[TIM_CNT] & 0xFFFF;
+
+    bool reference;
+    switch ((mode >> 4) & 7)
+    {
+        case 4://Force inactive
+            reference = false;
+            break;
+        case 5://Force active
+            reference = true;
+            break;
+        case 6://PWM mode 1
+            reference = count < compare;
+            break;
+        case 7://PWM mode 2
+            reference = count >= compare;
+            break;
+        default:
+            reference = oc3Latched;
+            break;
+    }
+
+    return (tim4[TIM_CCER] & (1 << 9)) ? !reference : reference;//CC3P: active low
+}
+
+//One cycle of SPI1 (master transmit only; bits take 2^(BR + 1) cycles)
+static void spiTick()
+{
+    if (!spiEnabled)
+        mosi = false;
+    else
+    {
+        if (!bitsLeft && txFull)//Move the next byte into the shift register
+        {
+            shift = txData;
+            txFull = false;
+            bitsLeft = 8;
+            bitCycle = 0;
+        }
+
+        if (bitsLeft)
+        {
+            if (!bitCycle)
+                mosi = shift & 0x80;//MSB first
+
+            if (++bitCycle == (2u << ((spi1[SPI_CR1] >> 3) & 7)))
+            {
+                bitCycle = 0;
+                shift <<= 1;
+                --bitsLeft;
+            }
+        }
+    }
+
+    spi1[SPI_SR] = (txFull ? 0 : (1 << 1)) | (bitsLeft ? (1 << 7) : 0);//TXE and BSY
+
+    if (!txFull && (spi1[SPI_CR2] & SPI_CR2_TXDMAEN))
+        dmaRequest(3);
+}
+
+//Level of an output pin (alternate is the level of its alternate function)
+static bool pin(volatile uint32_t* port, uint_fast8_t number, bool alternate)
+{
+    const uint32_t config = (port[(number < 8) ? GPIO_CRL : GPIO_CRH] >> ((number % 8) * 4)) & 0xF;
+
+    if (!(config & 0x3))
+        return false;//Input (nothing drives the output, so it's pulled down by the monitor)
+    if (config & 0x8)
+        return alternate;
+    return (port[GPIO_ODR] >> number) & 1;
+}
+
+//Advances every peripheral by a cycle and records the signal
+static void tick()
+{
+    timerTick();
+    spiTick();
+
+    if (dwt[DWT_CTRL_WORD] & 1)
+        ++dwt[DWT_CYCCNT_WORD];
+
+    const bool timerInterrupt = (nvicEnabled & (1 << 30)) && (tim4[TIM_SR] & tim4[TIM_DIER] & TIM_INTERRUPTS);
+    if (timerInterrupt && !timerPending)
+        timerEventCycle = now;
+    timerPending = timerInterrupt;
+
+    //Video (PA7) drives the output to 1v through its diode regardless of sync (PB8)
+    const bool video = pin(gpioa, 7, mosi);
+    const bool sync = pin(gpiob, 8, timerOutput3());
+    const uint8_t newLevel = video ? SIM_WHITE : (sync ? SIM_BLACK : SIM_SYNC);
+
+    if (newLevel != level)
+    {
+        edges = grow(edges, edgeCount, &edgeCapacity, sizeof(Sim_edge_t));
+        edges[edgeCount++] = (Sim_edge_t) {.cycle = now, .level = newLevel};
+        level = newLevel;
+    }
+
+    ++now;
+}
+
+//Priority of an exception (lower is more urgent; STM32s implement the top 4 bits)
+static uint_fast16_t exceptionPriority(uint_fast8_t exception)
+{
+    if (exception == SIM_PENDSV)
+        return (scs[SCB_SHPR3_WORD] >> 16) & 0xF0;
+
+    const uint_fast8_t irq = exception - 16;
+    return (scs[NVIC_IPR + (irq / 4)] >> ((irq % 4) * 8)) & 0xF0;
+}
+
+//Most urgent pending exception that is more urgent than threshold, or 0
+static uint_fast8_t pendingException(uint_fast16_t threshold)
+{
+    const bool timer = (nvicEnabled & (1 << 30)) && (tim4[TIM_SR] & tim4[TIM_DIER] & TIM_INTERRUPTS);
+
+    //With equal priorities the lower exception number goes first
+    if (pendSVPending && (exceptionPriority(SIM_PENDSV) < threshold) &&
+        (!timer || (exceptionPriority(SIM_PENDSV) <= exceptionPriority(SIM_TIM4))))
+        return SIM_PENDSV;
+    if (timer && (exceptionPriority(SIM_TIM4) < threshold))
+        return SIM_TIM4;
+    return 0;
+}
+
+//Runs the handler for exception, and any others that tail chain onto it
+static void takeException(uint_fast8_t exception)
+{
+    const uint_fast16_t preemptedPriority = priority;
+    const uint64_t outerPreemptedCycles = preemptedCycles;
+    const uint64_t start = now;
+
+    priority = exceptionPriority(exception);
+    advance(SIM_ENTRY_CYCLES);
+
+    while (true)
+    {
+        priority = exceptionPriority(exception);
+
+        Sim_interrupt_t record = {.entry = now, .exception = exception};
+        if (exception == SIM_PENDSV)
+        {
+            pendSVPending = false;
+            record.latency = now - pendSVCycle;
+        }
+        else
+            record.latency = now - timerEventCycle;
+
+        preemptedCycles = 0;
+        ++depth;
+        advance(SIM_HANDLER_CYCLES);
+        if (exception == SIM_PENDSV)
+            __ISR_PendSV();
+        else
+            __ISR_TIM4();
+        commit();
+        --depth;
+
+        record.exit = now;
+        record.cycles = (now - record.entry) - preemptedCycles;
+        interrupts = grow(interrupts, interruptCount, &interruptCapacity, sizeof(Sim_interrupt_t));
+        interrupts[interruptCount++] = record;
+
+        exception = pendingException(preemptedPriority);
+        if (!exception)
+            break;
+        advance(SIM_TAIL_CHAIN_CYCLES);
+    }
+
+    advance(SIM_EXIT_CYCLES);
+    priority = preemptedPriority;
+    preemptedCycles = outerPreemptedCycles + (now - start);//All of it is lost to whatever was preempted
+}
+
+//Lets cycles pass at the current priority (anything more urgent preempts)
+static void advance(uint32_t cycles)
+{
+    for (; cycles; --cycles)
+    {
+        tick();
+
+        const uint_fast8_t exception = pendingException(priority);
+        if (exception)
+            takeException(exception);
+    }
+}
+
+//Signal level at cycle
+static uint8_t levelAt(uint64_t cycle)
+{
+    if (!edgeCount || (cycle < edges[0].cycle))
+        return SIM_SYNC;
+
+    //Last edge at or before cycle
+    uint32_t low = 0, high = edgeCount;
+    while ((high - low) > 1)
+    {
+        const uint32_t middle = (low + high) / 2;
+        if (edges[middle].cycle <= cycle)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    return edges[low].level;
+}
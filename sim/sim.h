@@ -0,0 +1,116 @@
+/* Host simulator of the TIM4/SPI1/DMA video pipeline
+ * Builds composite.c (or one of the old versions) for a Linux host against a simulated register
+ * file (sim/bluepill.h), runs it cycle by cycle at 72mhz, and captures the composite signal that
+ * would reach the monitor, so changes to the ISR, resolutions and interlacing can be checked
+ * without a board or a scope
+ *
+** Building
+ * From the root of the repository:
+ *  gcc -std=gnu99 -O2 -no-pie -Isim -I- -I. -o compositesim sim/main.c sim/sim.c composite.c softrenderer.c
+ * -I- makes "bluepill.h" come from sim/ even for files next to the real one (gcc will note that it
+ * is obsolete; -iquote can't do this). -no-pie keeps static data below 4GiB, so the (uint32_t)
+ * pointer casts used for DMA addresses work like they do on the board. To compare designs, build
+ * with old versions/compositev*.c instead of composite.c (only Composite_init is used by main.c).
+ * Settings from composite.h can be given with -D (like -DCOMPOSITE_PAL, which sim.h follows too)
+ *
+** Running
+ *  ./compositesim [-f frames] [-s frames to skip] [-c cycles per pixel] [-o image.pgm] [-l lines.csv] [-e edges.csv]
+ * The first complete frame(s) after skipping are written as a PGM image of the raw signal (sync is
+ * black, blanking is dark grey, white is white), one row per line like a monitor would split them
+ * (a line starts at the first sync pulse at least 3/4 of a line after the last one), starting at
+ * the first line of a field's vertical sync. Every row is SIM_LINE_CYCLES long, so lines that are
+ * too long are cut off on the right and short ones show the start of the next line
+ * The line log has the timing of each of those lines, and the interrupts that started during it
+ * The edge file has every change of the sync and video pins in the same lines, in the format of a
+ * logic analyser export, so timingcheck.c can check either against the standard
+ *
+** Model
+ * Peripherals: TIM4 (up counting, preload, compare flags, update/compare DMA requests including
+ * DMAR bursts, PWM on channel 3), SPI1 (master transmit, TXE DMA requests, MOSI low while disabled
+ * and holding its last bit when idle), DMA1 (peripheral/memory transfers on request; no memory to
+ * memory), GPIOA/B (CRL/CRH, ODR, BSRR, BRR) and the NVIC (TIM4 and PendSV with priorities and
+ * preemption). Video is PA7 and sync is PB8 (see test.c)
+ * Timing: code doesn't take any time except in interrupts, where each register access takes
+ * SIM_ACCESS_CYCLES, each handler SIM_HANDLER_CYCLES more, and entering/leaving/tail chaining the
+ * cycles of a Cortex-M3. This is an estimate (other memory accesses and instructions are free), but
+ * it is the same for every design, so they can be compared, and interrupt latency is modelled
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "composite.h"
+
+/* Settings */
+#define SIM_CLOCK 72000000//Core, TIM4 and SPI1 clock (hz)
+#define SIM_ACCESS_CYCLES 3//Cost of a register access from an interrupt (bus access and the code around it)
+#define SIM_HANDLER_CYCLES 12//Cost of the rest of a handler (prologue/epilogue, branches, tables)
+#define SIM_ENTRY_CYCLES 12//Exception entry (stacking)
+#define SIM_EXIT_CYCLES 12//Exception return (unstacking)
+#define SIM_TAIL_CHAIN_CYCLES 6//Going straight from one handler to the next
+#ifdef COMPOSITE_PAL
+    #define SIM_LINE_CYCLES 4608//PAL line (64us); used to split the signal into lines
+    #define SIM_FRAME_LINES 625//Lines in 2 fields
+#else
+    #define SIM_LINE_CYCLES 4576//NTSC line (63.556us); used to split the signal into lines
+    #define SIM_FRAME_LINES 525//Lines in 2 fields
+#endif
+
+/* Constants */
+//Signal levels
+#define SIM_SYNC 0//0v
+#define SIM_BLACK 1//0.3v
+#define SIM_WHITE 2//1v
+
+//Exception numbers
+#define SIM_PENDSV 14
+#define SIM_TIM4 (16 + 30)
+
+/* Types */
+typedef struct
+{
+    uint64_t cycle;//When the signal changed to level
+    uint8_t level;//SIM_SYNC, SIM_BLACK or SIM_WHITE
+} Sim_edge_t;
+
+typedef struct
+{
+    uint64_t entry;//Cycle the handler started (after stacking)
+    uint64_t exit;//Cycle the handler returned
+    uint32_t cycles;//Cycles spent in the handler, not counting handlers that preempted it
+    uint32_t latency;//Cycles from the event to entry
+    uint8_t exception;//SIM_TIM4 or SIM_PENDSV
+} Sim_interrupt_t;
+
+typedef struct
+{
+    uint64_t start;//Cycle of the start of the line's sync pulse
+    uint32_t length;//Cycles until the next line starts
+    uint32_t syncWidth;//Cycles of the first sync pulse
+    uint16_t syncPulses;//Number of sync pulses that start in the line (2 for half lines)
+    bool vsync;//Has a broad (vertical sync) pulse
+    int32_t videoStart;//Cycles from start to the first white, or -1 if the line has none
+    int32_t videoEnd;//Cycles from start to the end of the last white
+    uint16_t interrupts;//Number of handlers started in the line
+    uint32_t interruptCycles;//Cycles spent in them (see Sim_interrupt_t)
+    uint32_t maxLatency;//Longest TIM4 latency
+} Sim_line_t;
+
+/* Functions */
+void Sim_run(uint64_t cycles);//Lets time pass, running interrupts as they happen
+uint64_t Sim_getCycles();//Cycles since the start
+
+//Everything recorded since the start
+const Sim_edge_t* Sim_getEdges(uint32_t* count);
+const Sim_interrupt_t* Sim_getInterrupts(uint32_t* count);
+const Sim_line_t* Sim_getLines(uint32_t* count);//Splits the signal into lines (valid until the next call)
+uint32_t Sim_findField(uint32_t line);//First line of a field's vertical sync at or after line (count if none)
+
+//Write lines first to last - 1 (from Sim_getLines)
+bool Sim_writePGM(const char* path, uint32_t first, uint32_t last, uint32_t cyclesPerPixel);
+bool Sim_writeLineLog(const char* path, uint32_t first, uint32_t last);
+bool Sim_writeEdges(const char* path, uint32_t first, uint32_t last);//Like a logic analyser (see timingcheck.c)
+
+#endif//SIM_H
@@ -0,0 +1,721 @@
+//Checks a recording of the sync and video pins against the composite timing standard
+//Reads a CSV of edges (a logic analyser export, or the simulator's -e output): a time in seconds
+//then one column per channel, with a row whenever something changes. Sync is PB8 and video is
+//PA7 (see test.c); video high is white, otherwise sync low is the sync tip
+//Reports each line's period, sync pulse and active video against SMPTE 170M (or BT.470 PAL), each
+//field's vertical interval (equalising/broad pulse counts and spacing, serrations, 262.5 or 312.5
+//line length, odd/even alternation), and how much the line starts jitter. Exits with 1 if anything
+//is out of tolerance, so it can tell how far the ISR can be cut before the signal breaks
+//
+//Building (from the root of the repository):
+// gcc -std=gnu99 -O2 -o timingcheck sim/timingcheck.c -lm
+//Running:
+// ./timingcheck [-s sync column] [-v video column (0 if none)] [-t tolerance scale] [-p] [-P] [-l lines.csv] edges.csv
+//-p expects progressive fields (a whole number of lines, all starting the same way) instead of
+//interlaced ones. -P checks against 625 line PAL instead of NTSC. -t multiplies every tolerance
+//(monitors lock onto much worse than the standard)
+//-l writes every line with its problems. Fields are numbered from 1 at the first line with a broad
+//pulse (lines before the first one that's completely recorded are in field 0, and aren't checked)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+/* Settings */
+#define LINE_JITTER_TOLERANCE 0.1//us; not from the standard: how far a line's period can be from the average
+#define MAX_COLUMNS 16
+
+/* Types */
+typedef struct
+{
+    const char* name;
+    double line;//us (H)
+    double frequencyTolerance;//ppm of the average line frequency
+    double hsync, hsyncTolerance;//us
+    double equalising, equalisingTolerance;//us
+    double serration, serrationTolerance;//us (gap between broad pulses)
+    double videoStart, videoStartTolerance;//Active video after the sync leading edge (us; can be later)
+    double frontPorch, frontPorchTolerance;//End of active video to the next sync (us; can be longer)
+    uint_fast8_t preEqualising, broad, postEqualising;//Pulses in each part of the vertical interval
+    double fieldLines;//Lines from one vertical sync to the next when interlaced
+} standard_t;
+
+typedef enum {LEVEL_SYNC, LEVEL_BLACK, LEVEL_WHITE} level_t;
+typedef enum {PULSE_EQUALISING, PULSE_HSYNC, PULSE_BROAD} pulseType_t;
+
+typedef struct
+{
+    double time;//us
+    level_t level;
+} run_t;
+
+typedef struct
+{
+    double start;//Leading edge (us)
+    double width;//us
+    pulseType_t type;
+} pulse_t;
+
+typedef struct
+{
+    double start;//us
+    double period;//To the next line (us)
+    uint32_t pulse;//Index of its first pulse
+    uint_fast8_t pulses;
+    bool broad;//Has a broad pulse
+    double videoStart;//From start (us), or -1 if there is no video
+    double frontPorch;//From the end of the video to the next line (us)
+    double jitter;//From the straight line fit through its field (us)
+    uint32_t field;
+    uint32_t lineInField;
+} line_t;
+
+typedef struct
+{
+    uint32_t line;//First line with a broad pulse
+    uint32_t firstBroad;//Pulse index
+    uint_fast8_t preEqualising, broad, postEqualising;
+    double start;//Leading edge of the first broad pulse (us)
+    double length;//To the next field (lines), or 0 for the last field
+    double spacingError;//Largest error of the spacing of vertical interval pulses from H/2 (us)
+    double serrationError;//Largest error of serration widths (us)
+    bool evenField;//Broad pulses start half a line after the line grid (field 2)
+    bool known;//The line grid before it was seen
+} field_t;
+
+/* Constants */
+static const standard_t ntsc =
+{
+    .name = "NTSC (SMPTE 170M)",
+    .line = 1000000.0 / 15734.264,//63.556us
+    .frequencyTolerance = 3,
+    .hsync = 4.7, .hsyncTolerance = 0.1,
+    .equalising = 2.3, .equalisingTolerance = 0.1,
+    .serration = 4.7, .serrationTolerance = 0.1,
+    .videoStart = 9.4, .videoStartTolerance = 0.2,//Blanking (10.9us) minus the front porch
+    .frontPorch = 1.5, .frontPorchTolerance = 0.1,
+    .preEqualising = 6, .broad = 6, .postEqualising = 6,
+    .fieldLines = 262.5
+};
+
+static const standard_t pal =
+{
+    .name = "PAL (ITU-R BT.470 B/G)",
+    .line = 64,//15625hz
+    .frequencyTolerance = 1,
+    .hsync = 4.7, .hsyncTolerance = 0.2,
+    .equalising = 2.35, .equalisingTolerance = 0.1,
+    .serration = 4.7, .serrationTolerance = 0.2,
+    .videoStart = 10.35, .videoStartTolerance = 0.45,//Blanking (12 +-0.3us) minus the front porch
+    .frontPorch = 1.65, .frontPorchTolerance = 0.15,//1.5 to 1.8us
+    .preEqualising = 5, .broad = 5, .postEqualising = 5,
+    .fieldLines = 312.5
+};
+
+/* Variables */
+static const standard_t* standard = &ntsc;
+static double scale = 1;//Of the tolerances
+static bool progressive = false;
+
+static run_t* runs = 0;
+static uint32_t runCount = 0;
+static pulse_t* pulses = 0;
+static uint32_t pulseCount = 0;
+static line_t* lines = 0;
+static uint32_t lineCount = 0;
+static field_t* fields = 0;
+static uint32_t fieldCount = 0;
+
+/* Private Functions */
+static void* grow(void* array, uint32_t count, uint32_t* capacity, size_t size);
+static bool readEdges(const char* path, uint_fast8_t syncColumn, uint_fast8_t videoColumn);
+static void findPulses();
+static void findLines();
+static void findFields();
+static void fitJitter();
+static bool within(double value, double expected, double tolerance);
+static const char* pulseName(pulseType_t type);
+static uint32_t checkLines(FILE* log);
+static uint32_t checkFields();
+
+int main(int argc, char** argv)
+{
+    uint_fast8_t syncColumn = 1, videoColumn = 2;
+    const char* logPath = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "s:v:t:pPl:")) != -1)
+    {
+        switch (option)
+        {
+            case 's':
+                syncColumn = atoi(optarg);
+                break;
+            case 'v':
+                videoColumn = atoi(optarg);
+                break;
+            case 't':
+                scale = atof(optarg);
+                break;
+            case 'p':
+                progressive = true;
+                break;
+            case 'P':
+                standard = &pal;
+                break;
+            case 'l':
+                logPath = optarg;
+                break;
+            default:
+                optind = argc;//Print the usage
+                break;
+        }
+    }
+
+    if ((optind != (argc - 1)) || !syncColumn || (syncColumn >= MAX_COLUMNS) || (videoColumn >= MAX_COLUMNS) || (scale <= 0))
+    {
+        fprintf(stderr, "Usage: %s [-s sync column] [-v video column (0 if none)] [-t tolerance scale] [-p] [-P] [-l lines.csv] edges.csv\n", argv[0]);
+        return 2;
+    }
+
+    if (!readEdges(argv[optind], syncColumn, videoColumn))
+        return 2;
+
+    findPulses();
+    findLines();
+    findFields();
+    fitJitter();
+
+    if (lineCount < 2)
+    {
+        fprintf(stderr, "Not enough sync pulses to find any lines\n");
+        return 2;
+    }
+
+    FILE* log = 0;
+    if (logPath && !(log = fopen(logPath, "w")))
+    {
+        fprintf(stderr, "Couldn't write %s\n", logPath);
+        return 2;
+    }
+
+    printf("%s, tolerances x%g%s\n", standard->name, scale, progressive ? ", progressive" : "");
+    const uint32_t problems = checkLines(log) + checkFields();
+
+    if (log && fclose(log))
+    {
+        fprintf(stderr, "Couldn't write %s\n", logPath);
+        return 2;
+    }
+
+    if (problems)
+        printf("FAIL: %u problems\n", problems);
+    else
+        printf("PASS\n");
+
+    return problems ? 1 : 0;
+}
+
+//Makes room for one more element at the end of array
+static void* grow(void* array, uint32_t count, uint32_t* capacity, size_t size)
+{
+    if (count < *capacity)
+        return array;
+
+    *capacity = *capacity ? (*capacity * 2) : 4096;
+    array = realloc(array, *capacity * size);
+    if (!array)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+
+    return array;
+}
+
+//Reads the CSV into runs of the composite level (rows that don't start with a number are skipped)
+static bool readEdges(const char* path, uint_fast8_t syncColumn, uint_fast8_t videoColumn)
+{
+    FILE* const file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "Couldn't read %s\n", path);
+        return false;
+    }
+
+    uint32_t capacity = 0;
+    char row[1024];
+    while (fgets(row, sizeof(row), file))
+    {
+        double columns[MAX_COLUMNS];
+        uint_fast8_t count = 0;
+        char* position = row;
+
+        while (count < MAX_COLUMNS)
+        {
+            char* end;
+            columns[count] = strtod(position, &end);
+            if (end == position)
+                break;
+
+            ++count;
+            position = end + strspn(end, " \t");
+            if (*position != ',')
+                break;
+            ++position;
+        }
+
+        if ((count <= syncColumn) || (count <= videoColumn))
+            continue;//Header, or a short row
+
+        const level_t level = (videoColumn && (columns[videoColumn] >= 0.5)) ? LEVEL_WHITE :
+                              ((columns[syncColumn] >= 0.5) ? LEVEL_BLACK : LEVEL_SYNC);
+
+        if (!runCount || (runs[runCount - 1].level != level))
+        {
+            runs = grow(runs, runCount, &capacity, sizeof(run_t));
+            runs[runCount++] = (run_t) {.time = columns[0] * 1000000, .level = level};
+        }
+    }
+
+    fclose(file);
+
+    if (!runCount)
+    {
+        fprintf(stderr, "No edges in %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+//Sync pulses that are completely in the recording, classified by width
+static void findPulses()
+{
+    uint32_t capacity = 0;
+
+    for (uint32_t i = 1; (i + 1) < runCount; ++i)//The first run may have started before the recording
+    {
+        if (runs[i].level != LEVEL_SYNC)
+            continue;
+
+        const double width = runs[i + 1].time - runs[i].time;
+        pulseType_t type;
+        if (width < ((standard->equalising + standard->hsync) / 2))
+            type = PULSE_EQUALISING;
+        else if (width < (standard->line / 4))
+            type = PULSE_HSYNC;
+        else
+            type = PULSE_BROAD;
+
+        pulses = grow(pulses, pulseCount, &capacity, sizeof(pulse_t));
+        pulses[pulseCount++] = (pulse_t) {.start = runs[i].time, .width = width, .type = type};
+    }
+}
+
+//Splits the pulses into lines like a monitor does: a pulse starts a new line unless it's less than
+//3/4 of a line after the start of the last one (the second pulse of a half line). The last line
+//is dropped since its period isn't known
+static void findLines()
+{
+    uint32_t capacity = 0;
+
+    for (uint32_t i = 0; i < pulseCount; ++i)
+    {
+        if (lineCount && ((pulses[i].start - lines[lineCount - 1].start) < (standard->line * 0.75)))
+        {
+            line_t* const line = &lines[lineCount - 1];
+            ++line->pulses;
+            line->broad |= pulses[i].type == PULSE_BROAD;
+            continue;
+        }
+
+        lines = grow(lines, lineCount, &capacity, sizeof(line_t));
+        lines[lineCount++] = (line_t) {.start = pulses[i].start, .pulse = i, .pulses = 1,
+                                       .broad = pulses[i].type == PULSE_BROAD, .videoStart = -1};
+    }
+
+    if (lineCount)
+        --lineCount;
+
+    //Active video in each line
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < lineCount; ++i)
+    {
+        line_t* const line = &lines[i];
+        const double end = lines[i + 1].start;
+        line->period = end - line->start;
+        line->frontPorch = line->period;
+
+        for (; (run < runCount) && (runs[run].time < end); ++run)
+        {
+            if ((runs[run].level != LEVEL_WHITE) || (runs[run].time < line->start))
+                continue;
+
+            if (line->videoStart < 0)
+                line->videoStart = runs[run].time - line->start;
+            if ((run + 1) < runCount)
+                line->frontPorch = end - runs[run + 1].time;
+        }
+    }
+}
+
+//A field starts at the first line with a broad pulse, and its vertical interval is the run of
+//equalising pulses before its broad pulses, them, and the equalising pulses after
+static void findFields()
+{
+    uint32_t capacity = 0;
+
+    for (uint32_t i = 0; i < lineCount; ++i)
+    {
+        if (!i || !lines[i].broad || lines[i - 1].broad)
+            continue;//Only the start of a field that's entirely in the recording
+
+        field_t field = {.line = i};
+
+        uint32_t pulse = lines[i].pulse;
+        while (pulses[pulse].type != PULSE_BROAD)
+            ++pulse;
+        field.firstBroad = pulse;
+        field.start = pulses[pulse].start;
+
+        //Pulses in each part of the vertical interval
+        uint32_t first = pulse;
+        while (first && (pulses[first - 1].type == PULSE_EQUALISING))
+        {
+            --first;
+            ++field.preEqualising;
+        }
+
+        uint32_t last = pulse;
+        while ((last < pulseCount) && (pulses[last].type == PULSE_BROAD))
+        {
+            ++field.broad;
+            ++last;
+        }
+
+        while ((last < pulseCount) && (pulses[last].type == PULSE_EQUALISING))
+        {
+            ++field.postEqualising;
+            ++last;
+        }
+
+        //Everything in the vertical interval comes every half line, and broad pulses are separated
+        //by serrations
+        for (uint32_t j = first; ((j + 1) < last) && ((j + 1) < pulseCount); ++j)
+        {
+            const double error = fabs((pulses[j + 1].start - pulses[j].start) - (standard->line / 2));
+            if (error > field.spacingError)
+                field.spacingError = error;
+
+            if ((pulses[j].type == PULSE_BROAD) && (pulses[j + 1].type == PULSE_BROAD))
+            {
+                const double serration = pulses[j + 1].start - (pulses[j].start + pulses[j].width);
+                const double serrationError = fabs(serration - standard->serration);
+                if (serrationError > field.serrationError)
+                    field.serrationError = serrationError;
+            }
+        }
+
+        //Where the broad pulses start relative to the line grid before the vertical interval
+        if (first)
+        {
+            const double offset = (field.start - pulses[first - 1].start) / standard->line;
+            const double fraction = offset - floor(offset);
+            field.evenField = (fraction > 0.25) && (fraction < 0.75);
+            field.known = pulses[first - 1].type == PULSE_HSYNC;
+        }
+
+        fields = grow(fields, fieldCount, &capacity, sizeof(field_t));
+        fields[fieldCount++] = field;
+    }
+
+    //Average line period (so the length of each field isn't thrown off by the clock being off)
+    double total = 0;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < lineCount; ++i)
+    {
+        if (fabs(lines[i].period - standard->line) < (standard->line / 4))
+        {
+            total += lines[i].period;
+            ++count;
+        }
+    }
+    const double averageLine = count ? (total / count) : standard->line;
+
+    for (uint32_t i = 0; i < fieldCount; ++i)
+    {
+        if ((i + 1) < fieldCount)
+            fields[i].length = (fields[i + 1].start - fields[i].start) / averageLine;
+
+        //Number the lines of the field (and the ones before the first field as part of none)
+        const uint32_t end = ((i + 1) < fieldCount) ? fields[i + 1].line : lineCount;
+        for (uint32_t j = fields[i].line; j < end; ++j)
+        {
+            lines[j].field = i + 1;
+            lines[j].lineInField = j - fields[i].line;
+        }
+    }
+}
+
+//Jitter is how far each line starts from a straight line fit through the starts of its field's
+//lines (what a monitor's horizontal oscillator follows)
+static void fitJitter()
+{
+    for (uint32_t first = 0; first < lineCount;)
+    {
+        uint32_t end = first;
+        while ((end < lineCount) && (lines[end].field == lines[first].field))
+            ++end;
+
+        double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+        const double n = end - first;
+        for (uint32_t i = first; i < end; ++i)
+        {
+            const double x = i - first, y = lines[i].start - lines[first].start;
+            sumX += x;
+            sumY += y;
+            sumXX += x * x;
+            sumXY += x * y;
+        }
+
+        const double denominator = (n * sumXX) - (sumX * sumX);
+        const double slope = (denominator != 0) ? (((n * sumXY) - (sumX * sumY)) / denominator) : standard->line;
+        const double intercept = (sumY - (slope * sumX)) / n;
+
+        for (uint32_t i = first; i < end; ++i)
+            lines[i].jitter = (lines[i].start - lines[first].start) - (intercept + (slope * (i - first)));
+
+        first = end;
+    }
+}
+
+static bool within(double value, double expected, double tolerance)
+{
+    return fabs(value - expected) <= (tolerance * scale);
+}
+
+static const char* pulseName(pulseType_t type)
+{
+    switch (type)
+    {
+        case PULSE_EQUALISING:
+            return "equalising";
+        case PULSE_HSYNC:
+            return "hsync";
+        default:
+            return "broad";
+    }
+}
+
+//Checks every line (writing them to log if there is one), prints a summary, and returns the
+//number of problems
+static uint32_t checkLines(FILE* log)
+{
+    if (log)
+        fprintf(log, "line,field,line_in_field,start_us,period_us,period_error_ns,jitter_ns,pulse,pulses,sync_width_us,sync_error_ns,video_start_us,front_porch_us,problems\n");
+
+    //The average is what the jitter tolerance applies to
+    double total = 0;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < lineCount; ++i)
+    {
+        if (!fieldCount || lines[i].field)
+        {
+            total += lines[i].period;
+            ++count;
+        }
+    }
+    double average = total / count;
+
+    uint32_t badPeriods = 0, badHsyncs = 0, badEqualising = 0, badVideoStarts = 0, badFrontPorches = 0;
+    double minHsync = INFINITY, maxHsync = 0, minEqualising = INFINITY, maxEqualising = 0;
+    double minVideoStart = INFINITY, minFrontPorch = INFINITY;
+    const double earliestVideo = standard->videoStart - (standard->videoStartTolerance * scale);
+    const double shortestFrontPorch = standard->frontPorch - (standard->frontPorchTolerance * scale);
+    double minPeriod = INFINITY, maxPeriod = 0, jitterSquares = 0, minJitter = 0, maxJitter = 0;
+    double fullLines = 0;
+    uint32_t fullLineCount = 0;
+
+    uint32_t checked = 0;
+    for (uint32_t i = 0; i < lineCount; ++i)
+    {
+        const line_t* const line = &lines[i];
+        const pulse_t* const pulse = &pulses[line->pulse];
+        char problems[64] = "";
+
+        //Until the first vertical sync, lines may have been split half a line off
+        if (fieldCount && !line->field)
+            continue;
+        ++checked;
+
+        //Lines in the vertical interval are made of half lines, but still start every H
+        if (!within(line->period, average, LINE_JITTER_TOLERANCE))
+        {
+            ++badPeriods;
+            strcat(problems, "period ");
+        }
+
+        if (line->period < minPeriod)
+            minPeriod = line->period;
+        if (line->period > maxPeriod)
+            maxPeriod = line->period;
+        if (!line->broad && (line->pulses == 1))
+        {
+            fullLines += line->period;
+            ++fullLineCount;
+        }
+
+        jitterSquares += line->jitter * line->jitter;
+        if (line->jitter < minJitter)
+            minJitter = line->jitter;
+        if (line->jitter > maxJitter)
+            maxJitter = line->jitter;
+
+        double syncError = 0;
+        if (pulse->type == PULSE_HSYNC)
+        {
+            syncError = pulse->width - standard->hsync;
+            if (!within(pulse->width, standard->hsync, standard->hsyncTolerance))
+            {
+                ++badHsyncs;
+                strcat(problems, "hsync ");
+            }
+
+            if (pulse->width < minHsync)
+                minHsync = pulse->width;
+            if (pulse->width > maxHsync)
+                maxHsync = pulse->width;
+        }
+        else if (pulse->type == PULSE_EQUALISING)
+        {
+            syncError = pulse->width - standard->equalising;
+            if (!within(pulse->width, standard->equalising, standard->equalisingTolerance))
+            {
+                ++badEqualising;
+                strcat(problems, "equalising ");
+            }
+
+            if (pulse->width < minEqualising)
+                minEqualising = pulse->width;
+            if (pulse->width > maxEqualising)
+                maxEqualising = pulse->width;
+        }
+
+        if (line->videoStart >= 0)
+        {
+            if (line->videoStart < earliestVideo)
+            {
+                ++badVideoStarts;
+                strcat(problems, "video_start ");
+            }
+
+            if (line->frontPorch < shortestFrontPorch)
+            {
+                ++badFrontPorches;
+                strcat(problems, "front_porch ");
+            }
+
+            if (line->videoStart < minVideoStart)
+                minVideoStart = line->videoStart;
+            if (line->frontPorch < minFrontPorch)
+                minFrontPorch = line->frontPorch;
+        }
+
+        if (log)
+        {
+            if (*problems)
+                problems[strlen(problems) - 1] = '\0';
+
+            fprintf(log, "%u,%u,%u,%.3f,%.3f,%.1f,%.1f,%s,%u,%.3f,%.1f,", i, line->field, line->lineInField,
+                    line->start - lines[0].start, line->period, (line->period - standard->line) * 1000,
+                    line->jitter * 1000, pulseName(pulse->type), line->pulses, pulse->width, syncError * 1000);
+
+            if (line->videoStart >= 0)
+                fprintf(log, "%.3f,%.3f,%s\n", line->videoStart, line->frontPorch, problems);
+            else
+                fprintf(log, ",,%s\n", problems);
+        }
+    }
+
+    //The average line frequency is held to a few ppm
+    average = fullLineCount ? (fullLines / fullLineCount) : average;
+    const double ppm = ((standard->line / average) - 1) * 1000000;
+    const bool badFrequency = fabs(ppm) > (standard->frequencyTolerance * scale);
+
+    printf("%u lines checked, %u fields\n", checked, fieldCount);
+    printf("Line period: average %.4fus (%.3fkhz, %+.0fppm)%s\n", average, 1000 / average, ppm, badFrequency ? " OUT OF TOLERANCE" : "");
+    printf("             %.4f to %.4fus, jitter %.1fns rms, %.1f to %.1fns; %u lines more than %gns from the average\n",
+           minPeriod, maxPeriod, sqrt(jitterSquares / checked) * 1000, minJitter * 1000, maxJitter * 1000,
+           badPeriods, LINE_JITTER_TOLERANCE * scale * 1000);
+
+    if (minHsync <= maxHsync)
+        printf("Hsync: %.3f to %.3fus; %u out of %.1f +-%.2fus\n", minHsync, maxHsync, badHsyncs, standard->hsync, standard->hsyncTolerance * scale);
+    if (minEqualising <= maxEqualising)
+        printf("Equalising: %.3f to %.3fus; %u out of %.1f +-%.2fus\n", minEqualising, maxEqualising, badEqualising, standard->equalising, standard->equalisingTolerance * scale);
+    if (minVideoStart != INFINITY)
+    {
+        printf("Active video: starts %.3fus or more after sync; %u before %.2fus\n", minVideoStart, badVideoStarts, earliestVideo);
+        printf("Front porch: %.3fus or more; %u shorter than %.2fus\n", minFrontPorch, badFrontPorches, shortestFrontPorch);
+    }
+
+    return badFrequency + badPeriods + badHsyncs + badEqualising + badVideoStarts + badFrontPorches;
+}
+
+//Checks the vertical interval of every field, prints them, and returns the number of problems
+static uint32_t checkFields()
+{
+    uint32_t problems = 0;
+    const double fieldLines = progressive ? floor(standard->fieldLines) : standard->fieldLines;
+
+    for (uint32_t i = 0; i < fieldCount; ++i)
+    {
+        const field_t* const field = &fields[i];
+        char notes[160] = "";
+
+        if ((field->preEqualising != standard->preEqualising) || (field->broad != standard->broad) ||
+            (field->postEqualising != standard->postEqualising))
+        {
+            sprintf(notes + strlen(notes), " pulses should be %u/%u/%u;", standard->preEqualising, standard->broad, standard->postEqualising);
+            ++problems;
+        }
+
+        if (field->spacingError > (standard->line * 0.002 * scale))//Half lines to within the line's tolerance
+        {
+            sprintf(notes + strlen(notes), " spacing off by %.3fus;", field->spacingError);
+            ++problems;
+        }
+
+        if (field->serrationError > (standard->serrationTolerance * scale))
+        {
+            sprintf(notes + strlen(notes), " serration off by %.3fus;", field->serrationError);
+            ++problems;
+        }
+
+        if (field->length && !within(field->length, fieldLines, 0.01))
+        {
+            sprintf(notes + strlen(notes), " should be %g lines;", fieldLines);
+            ++problems;
+        }
+
+        //Interlaced fields alternate between starting on a line and half way through one
+        if (field->known && i && fields[i - 1].known &&
+            ((field->evenField == fields[i - 1].evenField) != progressive))
+        {
+            sprintf(notes + strlen(notes), progressive ? " should start like the last field;" : " should alternate with the last field;");
+            ++problems;
+        }
+
+        printf("Field %u (line %u): %s, ", i + 1, field->line, field->known ? (field->evenField ? "even" : "odd") : "?");
+        if (field->length)
+            printf("%.3f lines, ", field->length);
+        printf("%u/%u/%u pulses%s%s\n", field->preEqualising, field->broad, field->postEqualising,
+               *notes ? " -" : "", notes);
+    }
+
+    return problems;
+}
@@ -5,18 +5,206 @@
 //Private vars
 static uint8_t* fb;
 static const uint8_t* charRom;//128 bytes wide, 8 bytes down
+static uint8_t pattern[8] = {0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55};//Row y % 8 used for line y
+
+//Clip rectangle (right and bottom are exclusive); always within the framebuffer
+static int32_t clipLeft = 0, clipTop = 0;
+static int32_t clipRight = SR_BYTES_PER_LINE * 8, clipBottom = SR_LINES;
+
+#ifdef SR_DIRTY_TRACKING
+//Bytes of each line drawn to since the last SR_resetDirty (clean if the start isn't before the end)
+static uint8_t dirtyStart[SR_LINES] = {[0 ... (SR_LINES - 1)] = SR_BYTES_PER_LINE};
+static uint8_t dirtyEnd[SR_LINES];//Exclusive
+#endif
+
+#ifdef SR_DISPLAY_LISTS
+static SR_displayList_t* recording;//Drawing functions are recorded into this instead of drawing (unless 0)
+#endif
+
+//Fills or copies of rowLength bytes on each of rows rows (see SR_fillArea and SR_copyArea)
+typedef struct
+{
+    uint8_t* destination;//Start of the next row
+    const uint8_t* source;//Start of the next row to copy, or fillWord
+    int32_t destinationStride;//Bytes from one row to the next (negative when going bottom to top)
+    int32_t sourceStride;
+    uint32_t rowLength;//In bytes
+    uint32_t rows;//Rows left (including the one in progress)
+    uint32_t fillWord;//Fill value in every byte
+    bool copy;
+    void (*done)(void);
+} request_t;
+
+#if defined(SR_DMA_CHANNEL) && defined(__arm__)
+    #define SR_DMA//Requests are done by DMA (the host build does them with the CPU instead)
+#endif
+
+#ifdef SR_DMA
+static request_t queue[SR_DMA_QUEUE_LENGTH];//Requests from queueHead up to (not including) queueTail
+static volatile uint_fast8_t queueHead = 0, queueTail = 0;//Head moved on by the DMA interrupt, tail by queueRequest
+static volatile bool busy = false;//DMA is working on the request at queueHead
+#endif
+
+//sin(0 to 90 degrees) * 16384 (for arcs)
+static const int16_t sineTable[91] =
+{
+    0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563,
+    2845, 3126, 3406, 3686, 3964, 4240, 4516, 4790, 5063, 5334,
+    5604, 5872, 6138, 6402, 6664, 6924, 7182, 7438, 7692, 7943,
+    8192, 8438, 8682, 8923, 9162, 9397, 9630, 9860, 10087, 10311,
+    10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+    12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+    14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+    15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+    16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+    16384
+};
 
 //Private functions
+#ifdef SR_DISPLAY_LISTS
+static void record(void (*replay)(const SR_listEntry_t* arguments), const intptr_t* arguments, uint32_t count);
+static const SR_listEntry_t* replayCommand(const SR_listEntry_t* entry);
+#endif
+static void area(const uint8_t* source, int32_t sourceStride, int32_t xByte, int32_t y, int32_t xCount, int32_t yCount, uint8_t value, void (*done)(void));
+#ifdef SR_DMA
+static void queueRequest();
+static inline __attribute__ ((always_inline)) void startTransfer(const request_t* request);
+#else
+static inline __attribute__ ((always_inline)) void fillBytes(uint8_t* destination, uint32_t count, uint32_t fillWord);
+static inline __attribute__ ((always_inline)) void copyBytes(uint8_t* destination, const uint8_t* source, uint32_t count);
+#endif
+static inline __attribute__ ((always_inline)) void damage(int32_t left, int32_t top, int32_t right, int32_t bottom);
+static inline __attribute__ ((always_inline)) void clippedDamage(int32_t left, int32_t top, int32_t right, int32_t bottom);
+static inline __attribute__ ((always_inline)) uint8_t clipMask(int32_t xByte);
+static inline __attribute__ ((always_inline)) bool outsideClip(int32_t x, int32_t y, uint32_t radiusX, uint32_t radiusY);
+static inline __attribute__ ((always_inline)) void point(int32_t x, int32_t y, bool markDirty, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void charByByte(int32_t xByte, int32_t y, char c, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void text(int32_t xByte, int32_t y, const char* string, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void fillSpan(int32_t x, int32_t y, int32_t xCount, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void fillColumn(int32_t xByte, uint8_t mask, int32_t y, int32_t yCount, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void vLine(int32_t x, int32_t y, int32_t yCount, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) bool clipSteps(int32_t start, int32_t direction, int32_t minimum, int32_t maximum, int32_t deltaMajor, int32_t deltaMinor, bool minor, int32_t* first, int32_t* last);
+static inline __attribute__ ((always_inline)) void line(int32_t x0, int32_t y0, int32_t x1, int32_t y1, bool byByte, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void rectangle(int32_t x, int32_t y, int32_t xCount, int32_t yCount, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void rectangleByByte(int32_t xByte, int32_t y, int32_t xCount, int32_t yCount, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void fillRectangle(int32_t x, int32_t y, int32_t xCount, int32_t yCount, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void triangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void fillTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void circle(int32_t x, int32_t y, uint32_t radius, uint32_t startAngle, uint32_t endAngle, bool arc, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void fillCircle(int32_t x, int32_t y, uint32_t radius, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) void ellipse(int32_t x, int32_t y, uint32_t radiusX, uint32_t radiusY, bool fill, uint_fast8_t op);
+static inline __attribute__ ((always_inline)) uint8_t fetchByte(const uint8_t* row, int32_t bit, int32_t lastBit);
+static inline __attribute__ ((always_inline)) uint32_t fetchWord(uintptr_t address, uintptr_t first, uintptr_t last);
+static inline __attribute__ ((always_inline)) uint32_t applySource(uint32_t destination, uint32_t source, uint32_t mask, uint_fast8_t rop);
+static inline __attribute__ ((always_inline)) void blitRow(const uint8_t* sourceRow, const uint8_t* maskRow, int32_t sourceBit, int32_t x, int32_t y, int32_t xCount, bool masked, uint_fast8_t rop);
+static inline __attribute__ ((always_inline)) void blit(const uint8_t* source, const uint8_t* mask, uint32_t sourceStride, int32_t sourceX, int32_t sourceY, int32_t xCount, int32_t yCount, int32_t x, int32_t y, bool masked, uint_fast8_t rop);
 
 //Private macros
 #define SR_abs(num) ((uint32_t)(((int32_t)(num) < 0) ? -(int32_t)(num) : (int32_t)(num)))
+#define SR_min(a, b) (((a) < (b)) ? (a) : (b))
+#define SR_max(a, b) (((a) > (b)) ? (a) : (b))
+#define SR_line(y) (fb + ((y) * SR_BYTES_PER_LINE))//Address of the start of line y
+#ifdef SR_BIT_BAND//Word in the SRAM bit-band alias region for bit (0 is the LSB) of the byte at address
+    #define SR_bitBandAlias(address, bit) \
+        ((volatile uint32_t*)(0x22000000 + (((uint32_t)(address) - 0x20000000) * 32) + ((bit) * 4)))
+#endif
+#ifdef SR_DMA//Registers of channel SR_DMA_CHANNEL of DMA1 (channels are 20 bytes apart), and its interrupt
+    #define SR_DMA_REGISTER(offset) (*((volatile uint32_t*)(0x40020000 + (offset))))
+    #define SR_DMA_IFCR SR_DMA_REGISTER(0x04)
+    #define SR_DMA_CCR SR_DMA_REGISTER(0x08 + (20 * (SR_DMA_CHANNEL - 1)))
+    #define SR_DMA_CNDTR SR_DMA_REGISTER(0x0C + (20 * (SR_DMA_CHANNEL - 1)))
+    #define SR_DMA_CPAR SR_DMA_REGISTER(0x10 + (20 * (SR_DMA_CHANNEL - 1)))
+    #define SR_DMA_CMAR SR_DMA_REGISTER(0x14 + (20 * (SR_DMA_CHANNEL - 1)))
+    #define SR_DMA_FLAGS (0xF << (4 * (SR_DMA_CHANNEL - 1)))//In SR_DMA_IFCR
+    #define SR_DMA_IRQ (10 + SR_DMA_CHANNEL)//DMA1 channel 1 is IRQ 11
+    #define SR_DMA_IRQ_PRIORITY (*((volatile uint8_t*)(0xE000E400 + SR_DMA_IRQ)))//NVIC_IPR byte
+    #define SR_DMA_HANDLER(channel) SR_DMA_HANDLER_NAME(channel)//Expands channel first
+    #define SR_DMA_HANDLER_NAME(channel) __ISR_DMA1_Channel##channel
+    //SR_DMA_CCR (the "peripheral" is the destination, and "memory" is the source)
+    #define SR_DMA_FILL 0x4052//Memory to memory, low priority, 8 bit, destination postincrement, transfer complete interrupt
+    #define SR_DMA_COPY 0x40D2//Same as fill plus source postincrement
+    #define SR_DMA_WORDS 0x0A00//32 bit accesses instead of 8 bit
+    #define SR_DMA_ENABLE 0x0001
+#endif
+#define SR_swapPoints(xA, yA, xB, yB) do \
+{ \
+    const int32_t temporaryX = xA; xA = xB; xB = temporaryX; \
+    const int32_t temporaryY = yA; yA = yB; yB = temporaryY; \
+} while (0)
+
+//Raster operations (always constants, so each kernel is specialized for every one it is used with)
+#define ROP_SET 0//Set pixels (white); no suffix
+#define ROP_CLEAR 1//Clear pixels (black); _I
+#define ROP_XOR 2//Invert pixels; _X
+#define ROP_COPY 3//Copy pixels from the pattern; _P
+#define ROP_AND_NOT 4//Clear pixels that are set in the pattern; _N
+
+//SR_DEFINE_REPLAY defines replay_name, which calls name with the arguments of a recorded command
+//(in brackets, as expressions of arguments so each one is converted back to its parameter's type)
+//SR_RECORD records a call to replay_name with arguments (in brackets, converted to intptr_t) and
+//returns from the function using it if a display list is being recorded
+#ifdef SR_DISPLAY_LISTS
+    #define SR_ARGUMENTS(...) __VA_ARGS__
+    #define SR_DEFINE_REPLAY(name, replayed) static void replay_##name(const SR_listEntry_t* arguments) \
+    { \
+        name(SR_ARGUMENTS replayed); \
+    }
+    #define SR_RECORD(name, arguments) do \
+    { \
+        if (recording) \
+        { \
+            const intptr_t recordedArguments[] = {SR_ARGUMENTS arguments}; \
+            record(replay_##name, recordedArguments, sizeof(recordedArguments) / sizeof(intptr_t)); \
+            return; \
+        } \
+    } while (0)
+    //The first n recorded arguments (SR_VALUES_n), for functions that only take integers
+    #define SR_VALUES_2 arguments[0].value, arguments[1].value
+    #define SR_VALUES_3 SR_VALUES_2, arguments[2].value
+    #define SR_VALUES_4 SR_VALUES_3, arguments[3].value
+    #define SR_VALUES_5 SR_VALUES_4, arguments[4].value
+    #define SR_VALUES_6 SR_VALUES_5, arguments[5].value
+#else
+    #define SR_DEFINE_REPLAY(name, replayed)
+    #define SR_RECORD(name, arguments) do {} while (0)
+#endif
+
+//Defines the public function name (and its _I, _X, _P and _N versions) to call kernel with the
+//arguments after the names of the parameters (in brackets, for recording) and how they are
+//replayed (see SR_DEFINE_REPLAY), followed by the raster operation
+#define SR_DEFINE_ROP(name, op, kernel, parameters, arguments, replayed, ...) \
+SR_DEFINE_REPLAY(name, replayed) \
+void name parameters \
+{ \
+    SR_RECORD(name, arguments); \
+    kernel(__VA_ARGS__, op); \
+}
+#define SR_DEFINE_ROPS(name, kernel, parameters, arguments, replayed, ...) \
+    SR_DEFINE_ROP(name, ROP_SET, kernel, parameters, arguments, replayed, __VA_ARGS__) \
+    SR_DEFINE_ROP(name##_I, ROP_CLEAR, kernel, parameters, arguments, replayed, __VA_ARGS__) \
+    SR_DEFINE_ROP(name##_X, ROP_XOR, kernel, parameters, arguments, replayed, __VA_ARGS__) \
+    SR_DEFINE_ROP(name##_P, ROP_COPY, kernel, parameters, arguments, replayed, __VA_ARGS__) \
+    SR_DEFINE_ROP(name##_N, ROP_AND_NOT, kernel, parameters, arguments, replayed, __VA_ARGS__)
+
+//Word access into the framebuffer (allowed to alias the bytes it is made of)
+typedef uint32_t __attribute__ ((may_alias)) word_t;
+typedef uint32_t __attribute__ ((may_alias, aligned (1))) unalignedWord_t;//Same but at any address
 
 /* Public Functions */
 
 /* Initialization */
 void SR_setFrameBuffer(uint8_t* frameBuffer)//Must have dimensions specified above
 {
+#ifdef SR_BIT_BAND//Only the first 1MiB of SRAM has a bit-band alias
+    assert(((uint32_t)frameBuffer >= 0x20000000) && (((uint32_t)frameBuffer + (SR_BYTES_PER_LINE * SR_LINES)) <= 0x20100000));
+#endif
+    
     fb = frameBuffer;
+    
+#ifdef SR_DMA//Lowest priority so drawing never delays the timer interrupt and video
+    SR_DMA_IRQ_PRIORITY = 0xFF;
+    NVIC_ISER0 = 1 << SR_DMA_IRQ;//Enable the DMA channel interrupt in the nvic
+#endif
 }
 
 void SR_setCharacterRom(const uint8_t characterRom[128][8])//8x8 and in ASCII order
@@ -24,127 +212,131 @@ void SR_setCharacterRom(const uint8_t characterRom[128][8])//8x8 and in ASCII or
     charRom = (uint8_t*)(characterRom);
 }
 
+SR_DEFINE_REPLAY(SR_setPattern, ((const uint8_t*)arguments[0].value))
+void SR_setPattern(const uint8_t newPattern[8])
+{
+    SR_RECORD(SR_setPattern, ((intptr_t)newPattern));
+    
+    for (uint32_t i = 0; i < 8; ++i)
+        pattern[i] = newPattern[i];
+}
+
+void SR_setClip(int32_t x, int32_t y, uint32_t xCount, uint32_t yCount)
+{
+    //Limited to the framebuffer, so nothing outside of it is ever written
+    clipLeft = SR_max(x, 0);
+    clipTop = SR_max(y, 0);
+    clipRight = SR_min(x + (int32_t)xCount, SR_BYTES_PER_LINE * 8);
+    clipBottom = SR_min(y + (int32_t)yCount, SR_LINES);
+    
+    if (clipRight < clipLeft)//Nothing is drawn
+        clipRight = clipLeft;
+    if (clipBottom < clipTop)
+        clipBottom = clipTop;
+}
+
+void SR_resetClip()
+{
+    SR_setClip(0, 0, SR_BYTES_PER_LINE * 8, SR_LINES);
+}
+
 /* Point Drawing */
-void SR_writeToByte(uint32_t xByte, uint32_t y, uint8_t data)
+SR_DEFINE_REPLAY(SR_writeToByte, (SR_VALUES_3))
+void SR_writeToByte(int32_t xByte, int32_t y, uint8_t data)
 {
+    SR_RECORD(SR_writeToByte, (xByte, y, data));
+    
+    if ((y < clipTop) || (y >= clipBottom))
+        return;
+    
+    const uint8_t mask = clipMask(xByte);//Pixels of the byte that can be written
+    if (!mask)
+        return;
+    
+    damage(xByte * 8, y, xByte * 8, y);
     uint8_t* const line = fb + (y * SR_BYTES_PER_LINE);//Determine line
     uint8_t* const destination = line + xByte;//Determine byte in line
-    *destination = data;//Write data to byte
+    *destination = (*destination & ~mask) | (data & mask);//Write data to byte
     __nop();//FIXME remove this once memset is implemented in bluepill.h
 }
 
-void SR_drawPointByByte(uint32_t xByte, uint32_t y)
+SR_DEFINE_REPLAY(SR_drawPointByByte, (SR_VALUES_2))
+void SR_drawPointByByte(int32_t xByte, int32_t y)
 {
-    uint8_t* const line = fb + (y * SR_BYTES_PER_LINE);//Determine line
-    uint8_t* const destination = line + xByte;//Determine byte in line
-    *destination = 0xFF;//Write 0xFF to byte
-    __nop();//FIXME remove this once memset is implemented in bluepill.h
+    SR_RECORD(SR_drawPointByByte, (xByte, y));
+    SR_writeToByte(xByte, y, 0xFF);//Write 0xFF to byte
 }
 
-void SR_drawPointByByte_I(uint32_t xByte, uint32_t y)
+SR_DEFINE_REPLAY(SR_drawPointByByte_I, (SR_VALUES_2))
+void SR_drawPointByByte_I(int32_t xByte, int32_t y)
 {
-    uint8_t* const line = fb + (y * SR_BYTES_PER_LINE);//Determine line
-    uint8_t* const destination = line + xByte;//Determine byte in line
-    *destination = 0x00;//Write 0xFF to byte
-    __nop();//FIXME remove this once memset is implemented in bluepill.h
+    SR_RECORD(SR_drawPointByByte_I, (xByte, y));
+    SR_writeToByte(xByte, y, 0x00);//Write 0x00 to byte
 }
 
-void SR_drawPointByByte_X(uint32_t xByte, uint32_t y)
+SR_DEFINE_REPLAY(SR_drawPointByByte_X, (SR_VALUES_2))
+void SR_drawPointByByte_X(int32_t xByte, int32_t y)
 {
     //Does not xor individual bits; ors all bits in byte, xors with that, and writes to all bits
+    SR_RECORD(SR_drawPointByByte_X, (xByte, y));
+    
+    if ((y < clipTop) || (y >= clipBottom))
+        return;
+    
+    const uint8_t mask = clipMask(xByte);//Only the bits inside the clip rectangle count
+    if (!mask)
+        return;
+    
+    damage(xByte * 8, y, xByte * 8, y);
     uint8_t* const line = fb + (y * SR_BYTES_PER_LINE);//Determine line
     uint8_t* const destination = line + xByte;//Determine byte in line
     
-    if (*destination)//Any of the bits of destination are set
-        *destination = 0x00;
+    if (*destination & mask)//Any of the bits of destination are set
+        *destination &= ~mask;
     else
-        *destination = 0xFF;
+        *destination |= mask;
 }
 
-void SR_drawPoint(uint32_t x, uint32_t y)
-{
-    uint8_t* const line = fb + (y * SR_BYTES_PER_LINE);//Determine line
-    uint8_t* const destination = line + (x / 8);//Determine byte in line
-    uint8_t bitmask = 0x80 >> (x % 8);//Determine bit in byte to set
-    *destination |= bitmask;//Set bit in byte
-}
+SR_DEFINE_ROPS(SR_drawPoint, point, (int32_t x, int32_t y), (x, y), (SR_VALUES_2), x, y, true)
 
-void SR_drawPoint_I(uint32_t x, uint32_t y)
+/* Screen Manipulation */
+SR_DEFINE_REPLAY(SR_fillArea, (SR_VALUES_5, (void (*)(void))arguments[5].value))
+void SR_fillArea(int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount, uint8_t value, void (*done)(void))
 {
-    uint8_t* const line = fb + (y * SR_BYTES_PER_LINE);//Determine line
-    uint8_t* const destination = line + (x / 8);//Determine byte in line
-    uint8_t bitmask = ~(0x80 >> (x % 8));//Determine bit in byte to clear
-    *destination &= bitmask;//Clear bit in byte
+    SR_RECORD(SR_fillArea, (xByte, y, xCount, yCount, value, (intptr_t)done));
+    area(0, 0, xByte, y, xCount, yCount, value, done);
 }
 
-void SR_drawPoint_X(uint32_t x, uint32_t y)
+SR_DEFINE_REPLAY(SR_copyArea, ((const uint8_t*)arguments[0].value, arguments[1].value, arguments[2].value,
+    arguments[3].value, arguments[4].value, arguments[5].value, (void (*)(void))arguments[6].value))
+void SR_copyArea(const uint8_t* source, uint32_t sourceStride, int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount, void (*done)(void))
 {
-    uint8_t* const line = fb + (y * SR_BYTES_PER_LINE);//Determine line
-    uint8_t* const destination = line + (x / 8);//Determine byte in line
-    uint8_t bitmask = 0x80 >> (x % 8);//Determine bit in byte to set
-    *destination ^= bitmask;//Xor bit in byte
+    SR_RECORD(SR_copyArea, ((intptr_t)source, sourceStride, xByte, y, xCount, yCount, (intptr_t)done));
+    area(source, sourceStride, xByte, y, xCount, yCount, 0, done);
 }
 
-/* Character Drawing */
-void SR_drawCharByByte(uint32_t xByte, uint32_t y, char c)
+bool SR_isBusy()
 {
-    //Bounds checking
-    assert(xByte < SR_BYTES_PER_LINE);
-    assert(y < (SR_LINES - 8));
-    
-    //Copy character from charRom to fb. c is the offset into charRom
-    const uint8_t* charPointer = charRom + (c * 8);//Index into character rom
-    uint8_t* line = fb + (y * SR_BYTES_PER_LINE);//Address of first line to copy char to
-    for (uint32_t i = 0; i < 8; ++i)
-    {
-        uint8_t* const destination = line + xByte;//Index into the line
-        *destination |= *charPointer;//Or byte of character into framebuffer
-        
-        line += SR_BYTES_PER_LINE;//Go to the next line
-        ++charPointer;//Go to next line of character
-    }
+#ifdef SR_DMA
+    return busy;
+#else
+    return false;//Everything is done before returning
+#endif
 }
 
-void SR_drawCharByByte_I(uint32_t xByte, uint32_t y, char c)
+void SR_waitUntilDone()
 {
-    //Bounds checking
-    assert(xByte < SR_BYTES_PER_LINE);
-    assert(y < (SR_LINES - 8));
-    
-    //Copy character from charRom to fb. c is the offset into charRom
-    const uint8_t* charPointer = charRom + (c * 8);//Index into character rom
-    uint8_t* line = fb + (y * SR_BYTES_PER_LINE);//Address of first line to copy char to
-    for (uint32_t i = 0; i < 8; ++i)
-    {
-        uint8_t* const destination = line + xByte;//Index into the line
-        *destination &= ~(*charPointer);//And inverted byte of character into framebuffer
-        
-        line += SR_BYTES_PER_LINE;//Go to the next line
-        ++charPointer;//Go to next line of character
-    }
+    while (SR_isBusy());
 }
 
-void SR_drawCharByByte_X(uint32_t xByte, uint32_t y, char c)
-{
-    //Bounds checking
-    assert(xByte < SR_BYTES_PER_LINE);
-    assert(y < (SR_LINES - 8));
-    
-    //Copy character from charRom to fb. c is the offset into charRom
-    const uint8_t* charPointer = charRom + (c * 8);//Index into character rom
-    uint8_t* line = fb + (y * SR_BYTES_PER_LINE);//Address of first line to copy char to
-    for (uint32_t i = 0; i < 8; ++i)
-    {
-        uint8_t* const destination = line + xByte;//Index into the line
-        *destination ^= *charPointer;//Xor byte of character into framebuffer
-        
-        line += SR_BYTES_PER_LINE;//Go to the next line
-        ++charPointer;//Go to next line of character
-    }
-}
+/* Character Drawing */
+SR_DEFINE_ROPS(SR_drawCharByByte, charByByte, (int32_t xByte, int32_t y, char c), (xByte, y, c), (SR_VALUES_3), xByte, y, c)
 
-void SR_drawStringByByte(uint32_t xByte, uint32_t y, const char* string)
+SR_DEFINE_REPLAY(SR_drawStringByByte, (SR_VALUES_2, (const char*)arguments[2].value))
+void SR_drawStringByByte(int32_t xByte, int32_t y, const char* string)
 {
+    SR_RECORD(SR_drawStringByByte, (xByte, y, (intptr_t)string));
+    
     while (true)
     {
         const char character = *string;
@@ -161,183 +353,1607 @@ void SR_drawStringByByte(uint32_t xByte, uint32_t y, const char* string)
     }
 }
 
-void _SR_drawText(uint32_t xByte, uint32_t y, const char* string, void (*drawCharByByte)(uint32_t, uint32_t, char))
+SR_DEFINE_ROPS(SR_drawText, text, (int32_t xByte, int32_t y, const char* string), (xByte, y, (intptr_t)string), (SR_VALUES_2, (const char*)arguments[2].value), xByte, y, string)
+
+/* Line Drawing */
+SR_DEFINE_REPLAY(SR_drawHLineByByte, (SR_VALUES_3))
+void SR_drawHLineByByte(int32_t xByte, int32_t y, uint32_t xCount)
 {
-    while (true)
+    SR_RECORD(SR_drawHLineByByte, (xByte, y, xCount));
+    fillSpan(xByte * 8, y, xCount * 8, ROP_SET);
+}
+
+SR_DEFINE_REPLAY(SR_drawVLineByByte, (SR_VALUES_3))
+void SR_drawVLineByByte(int32_t xByte, int32_t y, uint32_t yCount)
+{
+    SR_RECORD(SR_drawVLineByByte, (xByte, y, yCount));
+    fillColumn(xByte, 0xFF, y, yCount, ROP_SET);
+}
+
+SR_DEFINE_ROPS(SR_drawHLine, fillSpan, (int32_t x, int32_t y, uint32_t xCount), (x, y, xCount), (SR_VALUES_3), x, y, xCount)
+SR_DEFINE_ROPS(SR_drawVLine, vLine, (int32_t x, int32_t y, uint32_t yCount), (x, y, yCount), (SR_VALUES_3), x, y, yCount)
+SR_DEFINE_ROPS(SR_drawLineByByte, line, (int32_t xByte0, int32_t y0, int32_t xByte1, int32_t y1), (xByte0, y0, xByte1, y1), (SR_VALUES_4), xByte0, y0, xByte1, y1, true)
+SR_DEFINE_ROPS(SR_drawLine, line, (int32_t x0, int32_t y0, int32_t x1, int32_t y1), (x0, y0, x1, y1), (SR_VALUES_4), x0, y0, x1, y1, false)
+
+/* Shape Drawing */
+SR_DEFINE_ROPS(SR_drawRectangleByByte, rectangleByByte, (int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount), (xByte, y, xCount, yCount), (SR_VALUES_4), xByte, y, xCount, yCount)
+SR_DEFINE_ROPS(SR_drawRectangleByByte_F, fillRectangle, (int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount), (xByte, y, xCount, yCount), (SR_VALUES_4), xByte * 8, y, xCount * 8, yCount)
+SR_DEFINE_ROPS(SR_drawRectangle, rectangle, (int32_t x, int32_t y, uint32_t xCount, uint32_t yCount), (x, y, xCount, yCount), (SR_VALUES_4), x, y, xCount, yCount)
+SR_DEFINE_ROPS(SR_drawRectangle_F, fillRectangle, (int32_t x, int32_t y, uint32_t xCount, uint32_t yCount), (x, y, xCount, yCount), (SR_VALUES_4), x, y, xCount, yCount)
+SR_DEFINE_ROPS(SR_drawTriangle, triangle, (int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2), (x0, y0, x1, y1, x2, y2), (SR_VALUES_6), x0, y0, x1, y1, x2, y2)
+SR_DEFINE_ROPS(SR_drawTriangle_F, fillTriangle, (int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2), (x0, y0, x1, y1, x2, y2), (SR_VALUES_6), x0, y0, x1, y1, x2, y2)
+
+SR_DEFINE_ROPS(SR_drawCircle, circle, (int32_t x, int32_t y, uint32_t radius), (x, y, radius), (SR_VALUES_3), x, y, radius, 0, 0, false)
+SR_DEFINE_ROPS(SR_drawCircle_F, fillCircle, (int32_t x, int32_t y, uint32_t radius), (x, y, radius), (SR_VALUES_3), x, y, radius)
+SR_DEFINE_ROPS(SR_drawArc, circle, (int32_t x, int32_t y, uint32_t radius, uint32_t startAngle, uint32_t endAngle), (x, y, radius, startAngle, endAngle), (SR_VALUES_5), x, y, radius, startAngle, endAngle, true)
+SR_DEFINE_ROPS(SR_drawEllipse, ellipse, (int32_t x, int32_t y, uint32_t radiusX, uint32_t radiusY), (x, y, radiusX, radiusY), (SR_VALUES_4), x, y, radiusX, radiusY, false)
+SR_DEFINE_ROPS(SR_drawEllipse_F, ellipse, (int32_t x, int32_t y, uint32_t radiusX, uint32_t radiusY), (x, y, radiusX, radiusY), (SR_VALUES_4), x, y, radiusX, radiusY, true)
+
+/* Bitmap Drawing */
+//Each raster operation gets its own copy of the kernel so there are no decisions in the inner loops
+#define SR_BLIT_CASES(masked) \
+    switch (rop) \
+    { \
+        case SR_BLIT_COPY: \
+            blit(source, mask, sourceStride, sourceX, sourceY, xCount, yCount, x, y, masked, SR_BLIT_COPY); \
+            break; \
+        case SR_BLIT_OR: \
+            blit(source, mask, sourceStride, sourceX, sourceY, xCount, yCount, x, y, masked, SR_BLIT_OR); \
+            break; \
+        case SR_BLIT_AND: \
+            blit(source, mask, sourceStride, sourceX, sourceY, xCount, yCount, x, y, masked, SR_BLIT_AND); \
+            break; \
+        case SR_BLIT_XOR: \
+            blit(source, mask, sourceStride, sourceX, sourceY, xCount, yCount, x, y, masked, SR_BLIT_XOR); \
+            break; \
+        case SR_BLIT_AND_NOT: \
+            blit(source, mask, sourceStride, sourceX, sourceY, xCount, yCount, x, y, masked, SR_BLIT_AND_NOT); \
+            break; \
+    }
+
+SR_DEFINE_REPLAY(SR_blit, ((const uint8_t*)arguments[0].value, arguments[1].value, arguments[2].value,
+    arguments[3].value, arguments[4].value, arguments[5].value, arguments[6].value, arguments[7].value, arguments[8].value))
+void SR_blit(const uint8_t* source, uint32_t sourceStride, int32_t sourceX, int32_t sourceY, uint32_t xCount, uint32_t yCount, int32_t x, int32_t y, uint_fast8_t rop)
+{
+    SR_RECORD(SR_blit, ((intptr_t)source, sourceStride, sourceX, sourceY, xCount, yCount, x, y, rop));
+    
+    const uint8_t* const mask = 0;//Unused
+    SR_BLIT_CASES(false)
+}
+
+SR_DEFINE_REPLAY(SR_blitMasked, ((const uint8_t*)arguments[0].value, (const uint8_t*)arguments[1].value,
+    arguments[2].value, arguments[3].value, arguments[4].value, arguments[5].value, arguments[6].value, arguments[7].value,
+    arguments[8].value, arguments[9].value))
+void SR_blitMasked(const uint8_t* source, const uint8_t* mask, uint32_t sourceStride, int32_t sourceX, int32_t sourceY, uint32_t xCount, uint32_t yCount, int32_t x, int32_t y, uint_fast8_t rop)
+{
+    SR_RECORD(SR_blitMasked, ((intptr_t)source, (intptr_t)mask, sourceStride, sourceX, sourceY, xCount, yCount, x, y, rop));
+    SR_BLIT_CASES(true)
+}
+
+/* Dirty Region Tracking */
+#ifdef SR_DIRTY_TRACKING
+bool SR_getDirtyLine(uint32_t y, uint32_t* xByte, uint32_t* xCount)
+{
+    if ((y >= SR_LINES) || (dirtyStart[y] >= dirtyEnd[y]))
+        return false;//Nothing drawn
+    
+    *xByte = dirtyStart[y];
+    *xCount = dirtyEnd[y] - dirtyStart[y];
+    return true;
+}
+
+bool SR_getDirtyArea(uint32_t* xByte, uint32_t* y, uint32_t* xCount, uint32_t* yCount)
+{
+    uint32_t left = SR_BYTES_PER_LINE, right = 0;//Bytes (right is exclusive)
+    uint32_t top = SR_LINES, bottom = 0;//Lines (bottom is exclusive)
+    
+    for (uint32_t i = 0; i < SR_LINES; ++i)
     {
-        const char character = *(string++);//Dereference and increment
-        
-        switch (character)
-        {
-            case 0x00://Null byte
-            {
-                return;//Finished string
-            }
-            case '\t':
-            {
-                xByte += 4;//4 spaces
-                break;
-            }
-            case '\n':
-            case '\r':
-            {
-                //Cause wrap to occur by going past end of line
-                xByte = SR_BYTES_PER_LINE;//1 past end of line
-                break;
-            }
-            case '\v':
-            {
-                y += 8;//Move down one character
-                break;
-            }
-            default:
-            {
-                drawCharByByte(xByte, y, character);
-                ++xByte;
-            }
-        }
-        
-        if (xByte > (SR_BYTES_PER_LINE - 1))
+        if (dirtyStart[i] < dirtyEnd[i])
         {
-            //Wrap text
-            xByte = 0;
-            y += 8;
+            left = SR_min(left, dirtyStart[i]);
+            right = SR_max(right, dirtyEnd[i]);
+            top = SR_min(top, i);
+            bottom = i + 1;
         }
-        
-        if (y > (SR_LINES - 1))
-            y = 0;
     }
+    
+    if (top >= bottom)
+        return false;//Nothing drawn
+    
+    *xByte = left;
+    *y = top;
+    *xCount = right - left;
+    *yCount = bottom - top;
+    return true;
 }
 
-/* Line Drawing */
-void SR_drawHLineByByte(uint32_t xByte, uint32_t y, uint32_t xCount)
+void SR_markDirty(int32_t x, int32_t y, uint32_t xCount, uint32_t yCount)
 {
-    uint32_t end = xByte + xCount;
-    while (xByte < end)
+    //Limited to the framebuffer (not the clip rectangle; this is for things SR didn't draw)
+    const int32_t left = SR_max(x, 0);
+    const int32_t top = SR_max(y, 0);
+    const int32_t right = SR_min(x + (int32_t)xCount, SR_BYTES_PER_LINE * 8) - 1;
+    const int32_t bottom = SR_min(y + (int32_t)yCount, SR_LINES) - 1;
+    
+    if ((left <= right) && (top <= bottom))
+        damage(left, top, right, bottom);
+}
+
+void SR_resetDirty()
+{
+    for (uint32_t i = 0; i < SR_LINES; ++i)
     {
-        SR_drawPointByByte(xByte, y);
-        ++xByte;//Go to next byte
+        dirtyStart[i] = SR_BYTES_PER_LINE;
+        dirtyEnd[i] = 0;
     }
 }
+#endif
+
+/* Display Lists */
+#ifdef SR_DISPLAY_LISTS
+void SR_initList(SR_displayList_t* list, SR_listEntry_t* arena, uint32_t size)
+{
+    list->entries = arena;
+    list->size = size;
+    SR_clearList(list);
+}
+
+void SR_clearList(SR_displayList_t* list)
+{
+    list->length = 0;
+    list->position = 0;
+    list->overflowed = false;
+}
+
+void SR_beginList(SR_displayList_t* list)
+{
+    recording = list;
+}
+
+void SR_endList()
+{
+    recording = 0;//Not recording
+}
 
-void SR_drawVLineByByte(uint32_t xByte, uint32_t y, uint32_t yCount)
+void SR_replayList(const SR_displayList_t* list)
 {
-    uint32_t end = y + yCount;
-    while (y < end)
+    const SR_listEntry_t* entry = list->entries;
+    const SR_listEntry_t* const end = list->entries + list->length;
+    
+    while (entry < end)
+        entry = replayCommand(entry);
+}
+
+bool SR_replayListPart(SR_displayList_t* list, bool (*keepGoing)(void))
+{
+    while (list->position < list->length)
     {
-        SR_drawPointByByte(xByte, y);
-        ++y;//Go to next line
+        if (!keepGoing())
+            return false;//Carry on from here next time
+        
+        list->position = replayCommand(list->entries + list->position) - list->entries;
     }
+    
+    list->position = 0;//Finished; start from the beginning next time
+    return true;
+}
+
+void SR_replayListLines(const SR_displayList_t* list, int32_t top, int32_t bottom)
+{
+    //Narrow the clip rectangle to the lines while replaying. Commands are clipped before they are
+    //rasterized, so the parts on other lines cost little
+    const int32_t oldTop = clipTop, oldBottom = clipBottom;
+    clipTop = SR_max(clipTop, top);
+    clipBottom = SR_max(SR_min(clipBottom, bottom), clipTop);
+    
+    SR_replayList(list);
+    
+    clipTop = oldTop;
+    clipBottom = oldBottom;
 }
+#endif
+
 
-void _SR_drawHLine(uint32_t x, uint32_t y, uint32_t xCount, void (*plot)(uint32_t, uint32_t))
+/* Private Functions */
+
+//Applies op to the pixels of destination that are set in mask (patternRow is the pattern for the line)
+static inline __attribute__ ((always_inline)) void applyToByte(uint8_t* destination, uint8_t mask, uint8_t patternRow, uint_fast8_t op)
 {
-    //TODO for speed, do the bulk of the work by byte
-    uint32_t end = x + xCount;
-    while (x < end)
+    switch (op)
     {
-        plot(x, y);
-        ++x;//Go to next pixel
+        case ROP_SET:
+            *destination |= mask;
+            break;
+        case ROP_CLEAR:
+            *destination &= ~mask;
+            break;
+        case ROP_XOR:
+            *destination ^= mask;
+            break;
+        case ROP_COPY:
+            *destination = (*destination & ~mask) | (patternRow & mask);
+            break;
+        case ROP_AND_NOT:
+            *destination &= ~(patternRow & mask);
+            break;
     }
 }
-void _SR_drawVLine(uint32_t x, uint32_t y, uint32_t yCount, void (*plot)(uint32_t, uint32_t))
+
+//Applies op to all 32 pixels of destination (which must be word aligned)
+//patternWord is the pattern row in every byte, so byte order doesn't matter
+static inline __attribute__ ((always_inline)) void applyToWord(word_t* destination, uint32_t patternWord, uint_fast8_t op)
 {
-    uint32_t end = y + yCount;
-    while (y < end)
+    switch (op)
     {
-        plot(x, y);
-        ++y;//Go to next line
+        case ROP_SET:
+            *destination = 0xFFFFFFFF;
+            break;
+        case ROP_CLEAR:
+            *destination = 0x00000000;
+            break;
+        case ROP_XOR:
+            *destination ^= 0xFFFFFFFF;
+            break;
+        case ROP_COPY:
+            *destination = patternWord;
+            break;
+        case ROP_AND_NOT:
+            *destination &= ~patternWord;
+            break;
     }
 }
 
-void _SR_drawLine(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, void (*plot)(uint32_t, uint32_t))
+//Fills (if source is 0) or copies whole bytes of an area of the framebuffer, limited to the framebuffer
+static void area(const uint8_t* source, int32_t sourceStride, int32_t xByte, int32_t y, int32_t xCount, int32_t yCount, uint8_t value, void (*done)(void))
 {
-    //https://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
-    //TODO understand how this works and add comments
+    const int32_t left = SR_max(xByte, 0);
+    const int32_t top = SR_max(y, 0);
+    const int32_t right = SR_min(xByte + xCount, SR_BYTES_PER_LINE);//Exclusive
+    const int32_t bottom = SR_min(y + yCount, SR_LINES);
     
-    //Initial Parameters (Note: SR_abs works with unsigned values)
-    int32_t deltaX = SR_abs(x1 - x0);
-    int32_t deltaY = -SR_abs(y1 - y0);
+    if ((left >= right) || (top >= bottom))
+    {
+        if (done)//Nothing to do
+            done();
+        return;
+    }
     
-    int32_t xAddend = (x0 < x1) ? 1 : -1;
-    int32_t yAddend = (y0 < y1) ? 1 : -1;
+    damage(left * 8, top, (right * 8) - 1, bottom - 1);
     
-    //Drawing Loop
-    int32_t errorXY = deltaX + deltaY;
-    int32_t doubleErrorXY;
-    uint32_t x = x0, y = y0;
-    while (true)
+    //Filled in where DMA will read it from (fields are set one at a time so there's no memcpy)
+#ifdef SR_DMA
+    request_t* const request = &queue[queueTail];
+    while (((queueTail + 1) % SR_DMA_QUEUE_LENGTH) == queueHead);//Wait for room if the queue is full
+#else
+    request_t cpuRequest;
+    request_t* const request = &cpuRequest;
+#endif
+    
+    request->destination = SR_line(top) + left;
+    request->destinationStride = SR_BYTES_PER_LINE;
+    request->sourceStride = sourceStride;
+    request->rowLength = right - left;
+    request->rows = bottom - top;
+    request->fillWord = (uint32_t)value * 0x01010101;
+    request->copy = source != 0;
+    request->done = done;
+    
+    if (request->copy)
+        request->source = source + (left - xByte) + ((top - y) * sourceStride);
+    else
+        request->source = (const uint8_t*)&request->fillWord;//Read over and over by DMA
+    
+    if (request->copy && (request->destination > request->source))
     {
-        plot(x, y);
-        
-        if ((x == x1) && (y == y1))
-            return;//We're reached our destination point
-            
-        doubleErrorXY = 2 * errorXY;
-        
-        if (doubleErrorXY >= deltaY)//Wiki comment: (errorXY + errorX) > 0
-        {
-            errorXY += deltaY;
-            x += xAddend;
-        }
+        //Moving down, so go from the bottom up to avoid copying rows that were already overwritten
+        request->destination += (request->rows - 1) * request->destinationStride;
+        request->source += (request->rows - 1) * request->sourceStride;
+        request->destinationStride = -request->destinationStride;
+        request->sourceStride = -request->sourceStride;
+    }
+    else if ((request->rowLength == SR_BYTES_PER_LINE) && (!request->copy || (sourceStride == SR_BYTES_PER_LINE)) &&
+             ((request->rowLength * request->rows) <= 0xFFFF))//Limit of the DMA transfer counter
+    {
+        //Whole lines are contiguous, so they can be done in one go
+        request->rowLength *= request->rows;
+        request->rows = 1;
+    }
+    
+#ifdef SR_DMA
+    queueRequest();
+#else
+    for (uint32_t i = 0; i < request->rows; ++i)
+    {
+        if (request->copy)
+            copyBytes(request->destination, request->source, request->rowLength);
+        else
+            fillBytes(request->destination, request->rowLength, request->fillWord);
         
-        if (doubleErrorXY <= deltaX)//Wiki comment: (errorXY + errorY) < 0
-        {
-            errorXY += deltaX;
-            y += yAddend;
-        }
+        request->destination += request->destinationStride;
+        request->source += request->sourceStride;
+    }
+    
+    if (done)
+        done();
+#endif
+}
+
+#ifdef SR_DMA
+//Adds the request at queueTail to the queue, and starts it if DMA is idle
+static void queueRequest()
+{
+    const uint_fast8_t tail = queueTail;
+    
+    //The request must be in the queue before the interrupt can see it. If the interrupt finishes the
+    //last request before busy is read, it goes idle and this starts the new one; otherwise it sees
+    //the new tail and starts it itself
+    __asm__ volatile ("" : : : "memory");
+    queueTail = (tail + 1) % SR_DMA_QUEUE_LENGTH;
+    
+    if (!busy)
+    {
+        busy = true;
+        startTransfer(&queue[tail]);
     }
 }
 
-//Shape Drawing
-void _SR_drawRectangle(uint32_t x, uint32_t y, uint32_t xCount, uint32_t yCount, void (*plot)(uint32_t, uint32_t))
+//Sets the DMA channel up for the next row of request and starts it
+static inline __attribute__ ((always_inline)) void startTransfer(const request_t* request)
 {
-    _SR_drawHLine(x, y, xCount, plot);//Top
-    _SR_drawHLine(x, y + yCount, xCount, plot);//Bottom
-    _SR_drawVLine(x, y, yCount, plot);//Left
-    _SR_drawVLine(x + xCount, y, yCount, plot);//Right
+    //32 bit accesses need the addresses and length to be word aligned
+    const bool words = !((uint32_t)request->destination & 0b11) && !((uint32_t)request->source & 0b11) &&
+                       !(request->rowLength & 0b11);
+    
+    SR_DMA_CCR = 0;//Must be disabled to be set up
+    SR_DMA_CPAR = (uint32_t)request->destination;
+    SR_DMA_CMAR = (uint32_t)request->source;
+    SR_DMA_CNDTR = words ? (request->rowLength / 4) : request->rowLength;
+    SR_DMA_CCR = (request->copy ? SR_DMA_COPY : SR_DMA_FILL) | (words ? SR_DMA_WORDS : 0) | SR_DMA_ENABLE;
 }
 
-void SR_drawRectangleByByte_F(uint32_t xByte, uint32_t y, uint32_t xCount, uint32_t yCount)
+//Moves on to the next row of the request in progress, or the next request once it is done
+__attribute__ ((interrupt ("IRQ"))) void SR_DMA_HANDLER(SR_DMA_CHANNEL)()
 {
-    uint32_t end = y + yCount;
-    while (y < end)
+    SR_DMA_IFCR = SR_DMA_FLAGS;//Clear the interrupt
+    request_t* const request = &queue[queueHead];
+    
+    if (--request->rows)
+    {
+        request->destination += request->destinationStride;
+        request->source += request->sourceStride;
+        startTransfer(request);
+        return;
+    }
+    
+    void (* const done)(void) = request->done;
+    const uint_fast8_t head = (queueHead + 1) % SR_DMA_QUEUE_LENGTH;
+    queueHead = head;//The slot can be reused now
+    
+    if (head != queueTail)
+        startTransfer(&queue[head]);
+    else
     {
-        SR_drawHLineByByte(xByte, y, xCount);
-        ++y;
+        SR_DMA_CCR = 0;
+        busy = false;
     }
+    
+    if (done)
+        done();
+}
+#else
+//Sets count bytes from destination to fillWord (which has the same value in every byte)
+static inline __attribute__ ((always_inline)) void fillBytes(uint8_t* destination, uint32_t count, uint32_t fillWord)
+{
+    uint8_t* const end = destination + count;
+    
+    //Bytes until the next word boundary, then whole words, then the bytes left over
+    while ((destination < end) && ((uintptr_t)destination & 0b11))
+        *(destination++) = fillWord;
+    
+    for (; (end - destination) >= 4; destination += 4)
+        *(word_t*)destination = fillWord;
+    
+    while (destination < end)
+        *(destination++) = fillWord;
+}
+
+//Copies count bytes from source to destination (which can overlap if destination is before source)
+static inline __attribute__ ((always_inline)) void copyBytes(uint8_t* destination, const uint8_t* source, uint32_t count)
+{
+    uint8_t* const end = destination + count;
+    
+    //Same as fillBytes, with words read from source wherever it happens to be
+    while ((destination < end) && ((uintptr_t)destination & 0b11))
+        *(destination++) = *(source++);
+    
+    for (; (end - destination) >= 4; destination += 4, source += 4)
+        *(word_t*)destination = *(const unalignedWord_t*)source;
+    
+    while (destination < end)
+        *(destination++) = *(source++);
 }
+#endif
 
-void SR_drawRectangle_F(uint32_t x, uint32_t y, uint32_t xCount, uint32_t yCount)
+#ifdef SR_DISPLAY_LISTS
+//Adds a command to the list being recorded: the function that replays it, the number of arguments,
+//then the arguments
+static void record(void (*replay)(const SR_listEntry_t* arguments), const intptr_t* arguments, uint32_t count)
 {
-    uint32_t end = y + yCount;
-    while (y < end)
+    SR_displayList_t* const list = recording;
+    
+    //Once a command doesn't fit, everything after it is dropped too so nothing is drawn out of order
+    if (list->overflowed || ((list->length + 2 + count) > list->size))
     {
-        SR_drawHLine(x, y, xCount);
-        ++y;
+        list->overflowed = true;
+        return;
     }
+    
+    SR_listEntry_t* const entry = list->entries + list->length;
+    entry[0].replay = replay;
+    entry[1].value = count;
+    for (uint32_t i = 0; i < count; ++i)
+        entry[2 + i].value = arguments[i];
+    
+    list->length += 2 + count;
 }
 
-void SR_drawTriangle(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2)
+//Calls the command at entry and returns the entry after it
+static const SR_listEntry_t* replayCommand(const SR_listEntry_t* entry)
 {
-    SR_drawLine(x0, y0, x1, y1);
-    SR_drawLine(x1, y1, x2, y2);
-    SR_drawLine(x2, y2, x0, y0);
+    entry[0].replay(entry + 2);
+    return entry + 2 + entry[1].value;
 }
+#endif
 
-void SR_drawCircleByByte(uint32_t xByte, uint32_t y, uint32_t radius)
+//Records that pixels left to right of lines top to bottom (inclusive) have been drawn to, if
+//SR_DIRTY_TRACKING. They must be inside the framebuffer
+static inline __attribute__ ((always_inline)) void damage(int32_t left, int32_t top, int32_t right, int32_t bottom)
 {
-    //https://en.wikipedia.org/wiki/Midpoint_circle_algorithm
-    //TODO
+#ifdef SR_DIRTY_TRACKING
+    const uint8_t start = left / 8;
+    const uint8_t end = (right / 8) + 1;
+    
+    for (int32_t y = top; y <= bottom; ++y)
+    {
+        dirtyStart[y] = SR_min(dirtyStart[y], start);
+        dirtyEnd[y] = SR_max(dirtyEnd[y], end);
+    }
+#else
+    (void)left; (void)top; (void)right; (void)bottom;//Nothing to record
+#endif
+}
+
+//Like damage, but for an area that may go outside of the clip rectangle (only what's inside counts)
+static inline __attribute__ ((always_inline)) void clippedDamage(int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+    left = SR_max(left, clipLeft);
+    top = SR_max(top, clipTop);
+    right = SR_min(right, clipRight - 1);
+    bottom = SR_min(bottom, clipBottom - 1);
+    
+    if ((left <= right) && (top <= bottom))
+        damage(left, top, right, bottom);
 }
 
-void SR_drawCircleByByte_F(uint32_t xByte, uint32_t y, uint32_t radius)
+//The pixels of byte xByte (on any line) that are inside the clip rectangle
+static inline __attribute__ ((always_inline)) uint8_t clipMask(int32_t xByte)
 {
-    //TODO
+    const int32_t left = clipLeft - (xByte * 8);//Pixels of the byte left of the clip rectangle
+    const int32_t right = clipRight - (xByte * 8);//Pixels of the byte before its right edge
+    
+    if ((left >= 8) || (right <= 0))
+        return 0x00;
+    
+    uint8_t mask = 0xFF;
+    if (left > 0)
+        mask &= 0xFF >> left;
+    if (right < 8)
+        mask &= 0xFF << (8 - right);
+    return mask;
+}
 
+//True if nothing from radiusX left/right and radiusY above/below (x, y) is inside the clip rectangle
+static inline __attribute__ ((always_inline)) bool outsideClip(int32_t x, int32_t y, uint32_t radiusX, uint32_t radiusY)
+{
+    return ((x + (int32_t)radiusX) < clipLeft) || ((x - (int32_t)radiusX) >= clipRight) ||
+           ((y + (int32_t)radiusY) < clipTop) || ((y - (int32_t)radiusY) >= clipBottom);
 }
 
+//markDirty is false if the caller has already marked the whole shape the point is part of as dirty
+static inline __attribute__ ((always_inline)) void point(int32_t x, int32_t y, bool markDirty, uint_fast8_t op)
+{
+    if ((x < clipLeft) || (x >= clipRight) || (y < clipTop) || (y >= clipBottom))
+        return;
+    
+    if (markDirty)
+        damage(x, y, x, y);
+    
+    uint8_t* const destination = SR_line(y) + (x / 8);//Determine byte in line
+#ifdef SR_BIT_BAND
+    //Pixels are sent MSB first, so pixel x is bit 7 - (x % 8). Each access only touches that bit
+    const uint_fast8_t bit = 7 - (x % 8);
+    volatile uint32_t* const alias = SR_bitBandAlias(destination, bit);
+    
+    switch (op)
+    {
+        case ROP_SET:
+            *alias = 1;
+            break;
+        case ROP_CLEAR:
+            *alias = 0;
+            break;
+        case ROP_XOR:
+            *alias ^= 1;
+            break;
+        case ROP_COPY:
+            *alias = (pattern[y % 8] >> bit) & 1;
+            break;
+        case ROP_AND_NOT:
+            if ((pattern[y % 8] >> bit) & 1)
+                *alias = 0;
+            break;
+    }
+#else
+    applyToByte(destination, 0x80 >> (x % 8), pattern[y % 8], op);//Bit in byte to change
+#endif
+}
 
-/* Private Functions */
+static inline __attribute__ ((always_inline)) void charByByte(int32_t xByte, int32_t y, char c, uint_fast8_t op)
+{
+    //Clipping (only the lines and pixels of the character that are inside are drawn)
+    const uint8_t mask = clipMask(xByte);
+    const int32_t first = SR_max(clipTop - y, 0);
+    const int32_t last = SR_min(clipBottom - y, 8);//Exclusive
+    
+    if (!mask || (first >= last))
+        return;
+    
+    damage(xByte * 8, y + first, xByte * 8, y + last - 1);
+    
+    //Apply op to the set bits of each line of the character. c is the offset into charRom
+    const uint8_t* charPointer = charRom + (c * 8) + first;//Index into character rom
+    uint8_t* destination = SR_line(y + first) + xByte;//First byte to copy char to
+    for (int32_t i = first; i < last; ++i)
+    {
+        applyToByte(destination, *charPointer & mask, pattern[(y + i) % 8], op);
+        
+        destination += SR_BYTES_PER_LINE;//Go to the next line
+        ++charPointer;//Go to next line of character
+    }
+}
 
-//None so far
+static inline __attribute__ ((always_inline)) void text(int32_t xByte, int32_t y, const char* string, uint_fast8_t op)
+{
+    while (true)
+    {
+        const char character = *(string++);//Dereference and increment
+        
+        switch (character)
+        {
+            case 0x00://Null byte
+            {
+                return;//Finished string
+            }
+            case '\t':
+            {
+                xByte += 4;//4 spaces
+                break;
+            }
+            case '\n':
+            case '\r':
+            {
+                //Cause wrap to occur by going past end of line
+                xByte = SR_BYTES_PER_LINE;//1 past end of line
+                break;
+            }
+            case '\v':
+            {
+                y += 8;//Move down one character
+                break;
+            }
+            default:
+            {
+                charByByte(xByte, y, character, op);
+                ++xByte;
+            }
+        }
+        
+        if (xByte > (SR_BYTES_PER_LINE - 1))
+        {
+            //Wrap text
+            xByte = 0;
+            y += 8;
+        }
+        
+        if (y > (SR_LINES - 1))
+            y = 0;
+    }
+}
+
+//Applies op to xCount pixels of line y starting at x (clipped first)
+//The partial bytes at either end are masked, and everything in between is done a word at a time
+static inline __attribute__ ((always_inline)) void fillSpan(int32_t x, int32_t y, int32_t xCount, uint_fast8_t op)
+{
+    if ((y < clipTop) || (y >= clipBottom))
+        return;
+    
+    const int32_t end = SR_min(x + xCount, clipRight) - 1;//Last pixel of the span
+    x = SR_max(x, clipLeft);
+    
+    if (end < x)
+        return;//Nothing left
+    
+    damage(x, y, end, y);
+    uint8_t* const line = SR_line(y);
+    uint8_t* destination = line + (x / 8);
+    uint8_t* const last = line + (end / 8);
+    const uint8_t leftMask = 0xFF >> (x % 8);//Pixels from x to the end of the first byte
+    const uint8_t rightMask = 0xFF << (7 - (end % 8));//Pixels from the start of the last byte to end
+    const uint8_t patternRow = pattern[y % 8];
+    
+    if (destination == last)//Span is within a single byte
+    {
+        applyToByte(destination, leftMask & rightMask, patternRow, op);
+        return;
+    }
+    
+    applyToByte(destination, leftMask, patternRow, op);
+    ++destination;
+    
+    //Whole bytes until the next word boundary
+    while ((destination < last) && ((uint32_t)destination & 0b11))
+    {
+        applyToByte(destination, 0xFF, patternRow, op);
+        ++destination;
+    }
+    
+    //Whole words
+    const uint32_t patternWord = (uint32_t)patternRow * 0x01010101;
+    while ((last - destination) >= 4)
+    {
+        applyToWord((word_t*)destination, patternWord, op);
+        destination += 4;
+    }
+    
+    //Whole bytes left over
+    while (destination < last)
+    {
+        applyToByte(destination, 0xFF, patternRow, op);
+        ++destination;
+    }
+    
+    applyToByte(last, rightMask, patternRow, op);
+}
+
+//Applies op to the pixels set in mask of yCount bytes going down from byte xByte of line y
+//(clipped first)
+static inline __attribute__ ((always_inline)) void fillColumn(int32_t xByte, uint8_t mask, int32_t y, int32_t yCount, uint_fast8_t op)
+{
+    const int32_t last = SR_min(y + yCount, clipBottom);//Exclusive
+    y = SR_max(y, clipTop);
+    mask &= clipMask(xByte);
+    
+    if (!mask || (y >= last))
+        return;
+    
+    damage(xByte * 8, y, xByte * 8, last - 1);
+    
+    uint8_t* destination = SR_line(y) + xByte;
+    for (; y < last; ++y)
+    {
+        applyToByte(destination, mask, pattern[y % 8], op);
+        destination += SR_BYTES_PER_LINE;//Go to the next line
+    }
+}
+
+static inline __attribute__ ((always_inline)) void vLine(int32_t x, int32_t y, int32_t yCount, uint_fast8_t op)
+{
+    if ((x < clipLeft) || (x >= clipRight))
+        return;
+    
+    fillColumn(x / 8, 0x80 >> (x % 8), y, yCount, op);
+}
+
+//Moves destination/mask one pixel (or byte if byByte) to the right or left
+//column (x in bytes) is only kept track of if byByte
+#define SR_stepX(destination, mask, column, right, byByte) do \
+{ \
+    if (byByte) \
+    { \
+        destination += (right) ? 1 : -1; \
+        column += (right) ? 1 : -1; \
+    } \
+    else if (right) \
+    { \
+        mask >>= 1; \
+        if (!mask)/*Go to the start of the next byte*/ \
+        { \
+            mask = 0x80; \
+            ++destination; \
+        } \
+    } \
+    else \
+    { \
+        mask = (mask << 1) & 0xFF; \
+        if (!mask)/*Go to the end of the previous byte*/ \
+        { \
+            mask = 0x01; \
+            --destination; \
+        } \
+    } \
+} while (0)
+
+//Narrows the steps first to last of a line (along its major axis) to the ones where one of its
+//coordinates is from minimum to maximum. Along the major axis the coordinate is
+//start + direction * step; along the minor axis (if minor) it only moves on the steps Bresenham
+//moves it, floor((2 * deltaMinor * step + deltaMajor) / (2 * deltaMajor)) times by then
+//Returns false if there are no steps left
+static inline __attribute__ ((always_inline)) bool clipSteps(int32_t start, int32_t direction, int32_t minimum, int32_t maximum, int32_t deltaMajor, int32_t deltaMinor, bool minor, int32_t* first, int32_t* last)
+{
+    //How far the coordinate can move from start (in the line's direction) and still be inside
+    const int32_t lowest = (direction > 0) ? (minimum - start) : (start - maximum);
+    const int32_t highest = (direction > 0) ? (maximum - start) : (start - minimum);
+    
+    if (highest < 0)
+        return false;
+    
+    int64_t firstStep = lowest, lastStep = highest;
+    
+    if (minor)
+    {
+        //The minor coordinate has moved k times by the first step where
+        //2 * deltaMinor * step >= (2k - 1) * deltaMajor
+        const int64_t doubleMajor = 2 * (int64_t)deltaMajor;
+        const int64_t doubleMinor = 2 * (int64_t)deltaMinor;
+        
+        firstStep = (lowest > 0) ? (((doubleMajor * lowest) - deltaMajor + doubleMinor - 1) / doubleMinor) : 0;
+        lastStep = ((doubleMajor * (highest + 1)) - deltaMajor + doubleMinor - 1) / doubleMinor - 1;
+    }
+    
+    *first = SR_max(*first, firstStep);
+    *last = SR_min(*last, lastStep);
+    return *first <= *last;
+}
+
+//Draws a line between two points (inclusive). If byByte, x is in bytes and whole bytes are drawn
+//Instead of working out the address and bit of every pixel, a byte pointer and bitmask are stepped
+//Only the part inside the clip rectangle is stepped through, starting exactly where Bresenham would
+//be on the first pixel inside so clipping doesn't change which pixels are drawn
+static inline __attribute__ ((always_inline)) void line(int32_t x0, int32_t y0, int32_t x1, int32_t y1, bool byByte, uint_fast8_t op)
+{
+    //https://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
+    const int32_t deltaX = SR_abs(x1 - x0);
+    const int32_t deltaY = SR_abs(y1 - y0);
+    const bool right = x0 < x1;
+    const bool down = y0 < y1;
+    
+    //Clip rectangle in the units of x (bytes at least partly inside it if byByte)
+    const int32_t minimumX = byByte ? (clipLeft / 8) : clipLeft;
+    const int32_t maximumX = byByte ? ((clipRight - 1) / 8) : (clipRight - 1);
+    
+    //Cohen-Sutherland: nothing to do if both points are off the same side
+    if (((x0 < minimumX) && (x1 < minimumX)) || ((x0 > maximumX) && (x1 > maximumX)) ||
+        ((y0 < clipTop) && (y1 < clipTop)) || ((y0 >= clipBottom) && (y1 >= clipBottom)))
+        return;
+    
+    //Horizontal and vertical lines are just spans and columns (which clip themselves)
+    if (!deltaY)
+    {
+        const int32_t left = right ? x0 : x1;
+        
+        if (byByte)
+            fillSpan(left * 8, y0, (deltaX + 1) * 8, op);
+        else
+            fillSpan(left, y0, deltaX + 1, op);
+        
+        return;
+    }
+    else if (!deltaX)
+    {
+        const int32_t top = down ? y0 : y1;
+        
+        if (byByte)
+            fillColumn(x0, 0xFF, top, deltaY + 1, op);
+        else
+            vLine(x0, top, deltaY + 1, op);
+        
+        return;
+    }
+    
+    //Liang-Barsky: narrow the steps along the major axis to the ones inside each side
+    const bool mostlyHorizontal = deltaX >= deltaY;
+    const int32_t deltaMajor = mostlyHorizontal ? deltaX : deltaY;
+    const int32_t deltaMinor = mostlyHorizontal ? deltaY : deltaX;
+    int32_t first = 0, last = deltaMajor;
+    
+    if (!clipSteps(x0, right ? 1 : -1, minimumX, maximumX, deltaMajor, deltaMinor, !mostlyHorizontal, &first, &last))
+        return;
+    if (!clipSteps(y0, down ? 1 : -1, clipTop, clipBottom - 1, deltaMajor, deltaMinor, mostlyHorizontal, &first, &last))
+        return;
+    
+    //Where Bresenham is on step first: how many minor steps it has taken, and the error (below)
+    const int32_t minorSteps = ((2 * (int64_t)deltaMinor * first) + deltaMajor) / (2 * (int64_t)deltaMajor);
+    const int32_t majorError = (deltaMajor - deltaMinor) - (first * deltaMinor) + (minorSteps * deltaMajor);
+    const int32_t x = x0 + ((right ? 1 : -1) * (mostlyHorizontal ? first : minorSteps));
+    const int32_t y = y0 + ((down ? 1 : -1) * (mostlyHorizontal ? minorSteps : first));
+    const int32_t count = last - first;//Steps after the first one
+    
+    //Everything drawn is between the first and last pixel inside
+    const int32_t lastMinorSteps = ((2 * (int64_t)deltaMinor * last) + deltaMajor) / (2 * (int64_t)deltaMajor);
+    const int32_t lastX = x0 + ((right ? 1 : -1) * (mostlyHorizontal ? last : lastMinorSteps));
+    const int32_t lastY = y0 + ((down ? 1 : -1) * (mostlyHorizontal ? lastMinorSteps : last));
+    if (byByte)
+        clippedDamage(SR_min(x, lastX) * 8, SR_min(y, lastY), (SR_max(x, lastX) * 8) + 7, SR_max(y, lastY));
+    else
+        damage(SR_min(x, lastX), SR_min(y, lastY), SR_max(x, lastX), SR_max(y, lastY));
+    
+    //Start at the first point inside and move towards the second
+    uint8_t* destination = SR_line(y) + (byByte ? x : (x / 8));
+    uint_fast8_t mask = byByte ? 0xFF : (0x80 >> (x % 8));
+    int32_t column = x;//Only if byByte (the edge bytes of the clip rectangle are masked)
+    const int32_t lineStep = down ? SR_BYTES_PER_LINE : -SR_BYTES_PER_LINE;
+    uint_fast8_t patternIndex = y % 8;
+    const uint_fast8_t patternStep = down ? 1 : 7;//Adding 7 is subtracting 1 (mod 8)
+    
+    if (deltaX == deltaY)//Diagonal: x and y change every pixel
+    {
+        for (int32_t i = 0; i <= count; ++i)
+        {
+            applyToByte(destination, byByte ? clipMask(column) : mask, pattern[patternIndex], op);
+            
+            SR_stepX(destination, mask, column, right, byByte);
+            destination += lineStep;
+            patternIndex = (patternIndex + patternStep) % 8;
+        }
+    }
+    else if (mostlyHorizontal)//x changes every pixel, y only sometimes
+    {
+        //The error is how far the line is from the pixel centre, scaled by 2 * deltaX
+        int32_t error = majorError;
+        for (int32_t i = 0; i <= count; ++i)
+        {
+            applyToByte(destination, byByte ? clipMask(column) : mask, pattern[patternIndex], op);
+            
+            const int32_t doubleError = 2 * error;
+            error -= deltaY;
+            SR_stepX(destination, mask, column, right, byByte);
+            
+            if (doubleError <= deltaX)//Closer to the next line
+            {
+                error += deltaX;
+                destination += lineStep;
+                patternIndex = (patternIndex + patternStep) % 8;
+            }
+        }
+    }
+    else//Mostly vertical: y changes every pixel, x only sometimes
+    {
+        int32_t error = -majorError;
+        for (int32_t i = 0; i <= count; ++i)
+        {
+            applyToByte(destination, byByte ? clipMask(column) : mask, pattern[patternIndex], op);
+            
+            const int32_t doubleError = 2 * error;
+            error += deltaX;
+            destination += lineStep;
+            patternIndex = (patternIndex + patternStep) % 8;
+            
+            if (doubleError >= -deltaY)//Closer to the next column
+            {
+                error -= deltaY;
+                SR_stepX(destination, mask, column, right, byByte);
+            }
+        }
+    }
+}
+
+//Applies op to the outline of a rectangle (the bottom right corner is left out)
+//Every pixel is only touched once so the _X functions don't leave gaps at corners
+static inline __attribute__ ((always_inline)) void rectangle(int32_t x, int32_t y, int32_t xCount, int32_t yCount, uint_fast8_t op)
+{
+    const int32_t right = x + xCount;
+    
+    fillSpan(x, y, xCount, op);//Top
+    
+    if (yCount)
+        fillSpan(x, y + yCount, xCount, op);//Bottom
+    
+    if (yCount && xCount)
+        vLine(x, y + 1, yCount - 1, op);//Left (minus the top)
+    
+    vLine(right, y, yCount, op);//Right
+}
+
+//Like rectangle, but the sides are a whole byte wide
+static inline __attribute__ ((always_inline)) void rectangleByByte(int32_t xByte, int32_t y, int32_t xCount, int32_t yCount, uint_fast8_t op)
+{
+    rectangle(xByte * 8, y, xCount * 8, yCount, op);
+    
+    if (yCount && xCount)
+        fillColumn(xByte, 0x7F, y + 1, yCount - 1, op);//Rest of the left byte
+    
+    fillColumn(xByte + xCount, 0x7F, y, yCount, op);//Rest of the right byte
+}
+
+//Applies op to every pixel of a rectangle, one span per line (only the lines inside the clip rectangle)
+static inline __attribute__ ((always_inline)) void fillRectangle(int32_t x, int32_t y, int32_t xCount, int32_t yCount, uint_fast8_t op)
+{
+    const int32_t last = SR_min(y + yCount, clipBottom);//Exclusive
+    
+    for (y = SR_max(y, clipTop); y < last; ++y)
+        fillSpan(x, y, xCount, op);
+}
+
+//Walks the pixels line draws from (x0, y0) to (x1, y1) from top to bottom, so several lines can be
+//merged a line at a time. Along the major axis the pixel moves every step, and along the minor axis
+//when the error (2 * deltaMinor * step + deltaMajor, mod 2 * deltaMajor) wraps around
+typedef struct
+{
+    int32_t x, y;//Current pixel
+    int32_t count;//Pixels left inside the clip rectangle, including the current one
+    int32_t error;//0 to errorRange - 1
+    int32_t errorStep;//2 * deltaMinor, negative if the steps are taken from the second point back
+    int32_t errorRange;//2 * deltaMajor
+    int32_t majorStep;//Direction the major coordinate moves in (+1 or -1)
+    int32_t minorStep;//Direction the minor coordinate moves in when the error goes over errorRange
+    bool mostlyHorizontal;
+} outline_t;
+
+//Sets up outline at the topmost pixel of the line from (x0, y0) to (x1, y1) inside the clip rectangle
+static inline __attribute__ ((always_inline)) void initOutline(outline_t* outline, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    const int32_t deltaX = SR_abs(x1 - x0);
+    const int32_t deltaY = SR_abs(y1 - y0);
+    const int32_t xDirection = (x0 < x1) ? 1 : -1;
+    const int32_t yDirection = (y0 < y1) ? 1 : -1;
+    const bool mostlyHorizontal = deltaX >= deltaY;
+    const int32_t deltaMajor = mostlyHorizontal ? deltaX : deltaY;
+    const int32_t deltaMinor = mostlyHorizontal ? deltaY : deltaX;
+    
+    outline->count = 0;
+    
+    if (!deltaMajor)//A single point
+    {
+        if ((x0 >= clipLeft) && (x0 < clipRight) && (y0 >= clipTop) && (y0 < clipBottom))
+        {
+            outline->x = x0;
+            outline->y = y0;
+            outline->count = 1;
+        }
+        
+        return;
+    }
+    
+    //Same steps as line keeps after clipping. Horizontal and vertical lines only need the major
+    //axis clipped (clipSteps would divide by 0 for the other one, which never moves)
+    const bool minorInside = mostlyHorizontal ? ((y0 >= clipTop) && (y0 < clipBottom)) : ((x0 >= clipLeft) && (x0 < clipRight));
+    int32_t first = 0, last = deltaMajor;
+    if (!deltaMinor && !minorInside)
+        return;
+    if ((mostlyHorizontal || deltaMinor) && !clipSteps(x0, xDirection, clipLeft, clipRight - 1, deltaMajor, deltaMinor, !mostlyHorizontal, &first, &last))
+        return;
+    if ((!mostlyHorizontal || deltaMinor) && !clipSteps(y0, yDirection, clipTop, clipBottom - 1, deltaMajor, deltaMinor, mostlyHorizontal, &first, &last))
+        return;
+    
+    //y only ever moves in yDirection as the steps go up, so going down means going backwards if it's -1
+    const int32_t step = (yDirection > 0) ? first : last;
+    const int64_t numerator = (2 * (int64_t)deltaMinor * step) + deltaMajor;
+    const int32_t minorSteps = numerator / (2 * (int64_t)deltaMajor);
+    
+    outline->x = x0 + (xDirection * (mostlyHorizontal ? step : minorSteps));
+    outline->y = y0 + (yDirection * (mostlyHorizontal ? minorSteps : step));
+    outline->count = last - first + 1;
+    outline->error = numerator - (minorSteps * (2 * (int64_t)deltaMajor));
+    outline->errorStep = yDirection * 2 * deltaMinor;
+    outline->errorRange = 2 * deltaMajor;
+    outline->majorStep = yDirection * (mostlyHorizontal ? xDirection : yDirection);
+    outline->minorStep = mostlyHorizontal ? yDirection : xDirection;
+    outline->mostlyHorizontal = mostlyHorizontal;
+}
+
+//Moves outline to the next pixel down (or along the same line); the caller counts it
+static inline __attribute__ ((always_inline)) void stepOutline(outline_t* outline)
+{
+    int32_t minorStep = 0;
+    
+    outline->error += outline->errorStep;
+    
+    if (outline->error >= outline->errorRange)
+    {
+        outline->error -= outline->errorRange;
+        minorStep = outline->minorStep;
+    }
+    else if (outline->error < 0)//Going backwards
+    {
+        outline->error += outline->errorRange;
+        minorStep = -outline->minorStep;
+    }
+    
+    if (outline->mostlyHorizontal)
+    {
+        outline->x += outline->majorStep;
+        outline->y += minorStep;
+    }
+    else
+    {
+        outline->y += outline->majorStep;
+        outline->x += minorStep;
+    }
+}
+
+//Gives the pixels of outline on line y (always next to each other), and moves it past them
+//Returns false if it has none there
+static inline __attribute__ ((always_inline)) bool outlineRun(outline_t* outline, int32_t y, int32_t* left, int32_t* right)
+{
+    if (!outline->count || (outline->y != y))
+        return false;
+    
+    *left = *right = outline->x;
+    
+    while (--outline->count)
+    {
+        stepOutline(outline);
+        if (outline->y != y)
+            break;//Leave it on the first pixel of the next line
+        
+        *left = SR_min(*left, outline->x);
+        *right = SR_max(*right, outline->x);
+    }
+    
+    return true;
+}
+
+//Applies op to the same pixels as a line between each pair of points, but a line at a time with
+//the pixels of the edges on it merged into spans, so the pixels where edges meet (at the points,
+//or all along thin triangles) are only touched once and the _X functions don't leave gaps
+static inline __attribute__ ((always_inline)) void triangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint_fast8_t op)
+{
+    outline_t edges[3];
+    initOutline(&edges[0], x0, y0, x1, y1);
+    initOutline(&edges[1], x1, y1, x2, y2);
+    initOutline(&edges[2], x2, y2, x0, y0);
+    
+    const int32_t top = SR_max(SR_min(SR_min(y0, y1), y2), clipTop);
+    const int32_t bottom = SR_min(SR_max(SR_max(y0, y1), y2), clipBottom - 1);
+    
+    for (int32_t y = top; y <= bottom; ++y)
+    {
+        //Pixels of each edge on this line, sorted from left to right
+        int32_t lefts[3], rights[3];
+        uint_fast8_t runs = 0;
+        
+        for (uint_fast8_t i = 0; i < 3; ++i)
+        {
+            int32_t left, right;
+            if (!outlineRun(&edges[i], y, &left, &right))
+                continue;
+            
+            uint_fast8_t j = runs++;
+            for (; j && (lefts[j - 1] > left); --j)
+            {
+                lefts[j] = lefts[j - 1];
+                rights[j] = rights[j - 1];
+            }
+            
+            lefts[j] = left;
+            rights[j] = right;
+        }
+        
+        //One span for each group of runs that overlap or touch
+        for (uint_fast8_t i = 0; i < runs;)
+        {
+            const int32_t left = lefts[i];
+            int32_t right = rights[i];
+            
+            for (++i; (i < runs) && (lefts[i] <= (right + 1)); ++i)
+                right = SR_max(right, rights[i]);
+            
+            fillSpan(left, y, right - left + 1, op);
+        }
+    }
+}
+
+//Steps along a triangle edge one line at a time, giving the first pixel whose centre is at or to
+//the right of the edge. This is ceil(numerator / denominator), where the numerator grows by the
+//same amount every line; the quotient and remainder are stepped instead of dividing every line
+typedef struct
+{
+    int32_t x;//ceil(numerator / denominator)
+    int32_t error;//x * denominator - numerator (0 to denominator - 1)
+    int32_t xStep;//floor(numerator step / denominator)
+    int32_t errorStep;//numerator step - xStep * denominator (0 to denominator - 1)
+    int32_t denominator;
+} edge_t;
+
+//Rounds towards negative infinity (unlike /)
+static inline __attribute__ ((always_inline)) int32_t floorDivide(int32_t numerator, int32_t denominator)
+{
+    const int32_t quotient = numerator / denominator;
+    return ((numerator % denominator) < 0) ? (quotient - 1) : quotient;
+}
+
+//Sets up edge to give the pixels for the edge from (x0, y0) to (x1, y1) starting at line y (y0 < y1)
+static inline __attribute__ ((always_inline)) void initEdge(edge_t* edge, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t y)
+{
+    //Everything is doubled so the centre of pixel x, line y is (2x + 1, 2y + 1). The edge crosses
+    //the middle of line y at x0 + (x1 - x0) * (2y + 1 - 2y0) / (2(y1 - y0)), and the first pixel
+    //at or to the right of that is ceil(that - 1/2)
+    const int32_t deltaX = x1 - x0;
+    const int32_t deltaY = y1 - y0;
+    const int32_t numerator = ((2 * x0 - 1) * deltaY) + (deltaX * (2 * (y - y0) + 1));
+    
+    edge->denominator = 2 * deltaY;
+    edge->x = -floorDivide(-numerator, edge->denominator);
+    edge->error = (edge->x * edge->denominator) - numerator;
+    edge->xStep = floorDivide(2 * deltaX, edge->denominator);
+    edge->errorStep = (2 * deltaX) - (edge->xStep * edge->denominator);
+}
+
+//Moves edge down to the next line
+static inline __attribute__ ((always_inline)) void stepEdge(edge_t* edge)
+{
+    edge->x += edge->xStep;
+    edge->error -= edge->errorStep;
+    
+    if (edge->error < 0)//The remainder carried over into another whole pixel
+    {
+        edge->x += 1;
+        edge->error += edge->denominator;
+    }
+}
+
+//Fills the pixels whose centres are inside the triangle with spans
+//Top-left fill rule: pixels with centres exactly on a left edge are drawn, but ones on a right edge
+//aren't (centres are never exactly on a top/bottom edge), so triangles sharing an edge never
+//overlap or leave gaps between them
+static inline __attribute__ ((always_inline)) void fillTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint_fast8_t op)
+{
+    //Sort the points from top to bottom
+    if (y1 < y0)
+        SR_swapPoints(x0, y0, x1, y1);
+    if (y2 < y1)
+        SR_swapPoints(x1, y1, x2, y2);
+    if (y1 < y0)
+        SR_swapPoints(x0, y0, x1, y1);
+    
+    //Determine which side the long edge (from the top to the bottom point) is on
+    const int32_t cross = ((x1 - x0) * (y2 - y0)) - ((x2 - x0) * (y1 - y0));
+    if (!cross)
+        return;//No area
+    const bool longEdgeLeft = cross > 0;//The middle point is to the right of the long edge
+    
+    //Lines y0 to y2 - 1 have their centres inside the triangle
+    edge_t longEdge;
+    
+    for (uint_fast8_t half = 0; half < 2; ++half)
+    {
+        //Top half uses the edge from the top to middle point, bottom half from middle to bottom
+        //Only the lines inside the clip rectangle are stepped through
+        const int32_t top = SR_max(half ? y1 : y0, clipTop);
+        const int32_t bottom = SR_min(half ? y2 : y1, clipBottom);
+        
+        if (top >= bottom)
+            continue;//Flat top or bottom, or clipped
+        
+        initEdge(&longEdge, x0, y0, x2, y2, top);
+        edge_t shortEdge;
+        if (half)
+            initEdge(&shortEdge, x1, y1, x2, y2, top);
+        else
+            initEdge(&shortEdge, x0, y0, x1, y1, top);
+        
+        edge_t* const left = longEdgeLeft ? &longEdge : &shortEdge;
+        edge_t* const right = longEdgeLeft ? &shortEdge : &longEdge;
+        
+        for (int32_t y = top; y < bottom; ++y)
+        {
+            if (right->x > left->x)
+                fillSpan(left->x, y, right->x - left->x, op);
+            
+            stepEdge(&longEdge);
+            stepEdge(&shortEdge);
+        }
+    }
+}
+
+//Applies op to xCount pixels centred on x of line y, and line y - yOffset too if yOffset
+//(so every line is only drawn once, even when a shape is symmetric about line y)
+static inline __attribute__ ((always_inline)) void symmetricSpans(int32_t x, int32_t y, int32_t yOffset, int32_t halfWidth, uint_fast8_t op)
+{
+    fillSpan(x - halfWidth, y + yOffset, (2 * halfWidth) + 1, op);
+    
+    if (yOffset)
+        fillSpan(x - halfWidth, y - yOffset, (2 * halfWidth) + 1, op);
+}
+
+//Applies op to (x + xOffset, y + yOffset) mirrored about x and y, only once if mirroring gives
+//the same pixel (when an offset is 0). The caller marks the shape as dirty
+static inline __attribute__ ((always_inline)) void symmetricPoints(int32_t x, int32_t y, int32_t xOffset, int32_t yOffset, uint_fast8_t op)
+{
+    point(x + xOffset, y + yOffset, false, op);
+    
+    if (xOffset)
+        point(x - xOffset, y + yOffset, false, op);
+    
+    if (yOffset)
+    {
+        point(x + xOffset, y - yOffset, false, op);
+        
+        if (xOffset)
+            point(x - xOffset, y - yOffset, false, op);
+    }
+}
+
+//sin and cos of an angle in degrees (any size), scaled by 16384
+static inline __attribute__ ((always_inline)) void sineCosine(uint32_t angle, int32_t* sine, int32_t* cosine)
+{
+    angle %= 360;
+    const uint32_t quadrantAngle = angle % 90;
+    const int32_t a = sineTable[quadrantAngle];//sin of the angle within the quadrant
+    const int32_t b = sineTable[90 - quadrantAngle];//cos of the angle within the quadrant
+    
+    switch (angle / 90)
+    {
+        case 0: *sine = a; *cosine = b; break;
+        case 1: *sine = b; *cosine = -a; break;
+        case 2: *sine = -a; *cosine = -b; break;
+        default: *sine = -b; *cosine = a; break;
+    }
+}
+
+//True if the direction (xOffset, yOffset) (screen coordinates; y down) is within the arc going
+//counterclockwise from the start to end direction (given as (cos, sin) with y up)
+static inline __attribute__ ((always_inline)) bool inArc(int32_t xOffset, int32_t yOffset, int32_t startX, int32_t startY, int32_t endX, int32_t endY, bool reflex)
+{
+    const int32_t x = xOffset;
+    const int32_t y = -yOffset;//Flip so y is up like the angles
+    
+    if (reflex)//More than 180 degrees; in the arc unless strictly inside the rest of the circle
+        return !((((endX * y) - (endY * x)) > 0) && (((x * startY) - (y * startX)) > 0));
+    else//Counterclockwise of the start and clockwise of the end
+        return (((startX * y) - (startY * x)) >= 0) && (((x * endY) - (y * endX)) >= 0);
+}
+
+//Applies op to the outline of a circle, or if arc just the part of it from startAngle to endAngle
+//(degrees counterclockwise from 3 o'clock; the whole circle if they are the same)
+//Midpoint circle algorithm: one octant is stepped through and mirrored to the other seven
+static inline __attribute__ ((always_inline)) void circle(int32_t x, int32_t y, uint32_t radius, uint32_t startAngle, uint32_t endAngle, bool arc, uint_fast8_t op)
+{
+    //https://en.wikipedia.org/wiki/Midpoint_circle_algorithm
+    if (outsideClip(x, y, radius, radius))
+        return;
+    
+    clippedDamage(x - (int32_t)radius, y - (int32_t)radius, x + (int32_t)radius, y + (int32_t)radius);//Whole circle, even for arcs
+    
+    int32_t startX = 0, startY = 0, endX = 0, endY = 0;
+    bool reflex = false;
+    
+    if (arc)
+    {
+        const uint32_t sweep = (endAngle + 360 - (startAngle % 360)) % 360;
+        
+        if (sweep)
+        {
+            sineCosine(startAngle, &startY, &startX);
+            sineCosine(endAngle, &endY, &endX);
+            reflex = sweep > 180;
+        }
+        else
+            arc = false;//Whole circle
+    }
+    
+    int32_t xOffset = radius, yOffset = 0;
+    int32_t error = 1 - (int32_t)radius;//Whether the midpoint between the next 2 pixels is outside
+    
+    while (xOffset >= yOffset)
+    {
+        //The octant's point mirrored about y = x (unless it is on y = x) and then both axes
+        for (uint_fast8_t swap = 0; swap < ((xOffset != yOffset) ? 2 : 1); ++swap)
+        {
+            const int32_t pointX = swap ? yOffset : xOffset;
+            const int32_t pointY = swap ? xOffset : yOffset;
+            
+            if (arc)
+            {
+                for (uint_fast8_t mirror = 0; mirror < 4; ++mirror)
+                {
+                    if ((mirror & 1) && !pointX)
+                        continue;//Same pixel as the unmirrored one
+                    if ((mirror & 2) && !pointY)
+                        continue;
+                    
+                    const int32_t mirroredX = (mirror & 1) ? -pointX : pointX;
+                    const int32_t mirroredY = (mirror & 2) ? -pointY : pointY;
+                    
+                    if (inArc(mirroredX, mirroredY, startX, startY, endX, endY, reflex))
+                        point(x + mirroredX, y + mirroredY, false, op);
+                }
+            }
+            else
+                symmetricPoints(x, y, pointX, pointY, op);
+        }
+        
+        ++yOffset;
+        if (error < 0)
+            error += (2 * yOffset) + 1;
+        else
+        {
+            --xOffset;
+            error += (2 * (yOffset - xOffset)) + 1;
+        }
+    }
+}
+
+//Applies op to every pixel of the circle (the same ones circle draws and everything inside them)
+//One span is drawn per line
+static inline __attribute__ ((always_inline)) void fillCircle(int32_t x, int32_t y, uint32_t radius, uint_fast8_t op)
+{
+    if (outsideClip(x, y, radius, radius))
+        return;
+    
+    int32_t xOffset = radius, yOffset = 0;
+    int32_t error = 1 - (int32_t)radius;
+    
+    while (xOffset >= yOffset)
+    {
+        //Lines yOffset away are as wide as the octant's point, and are only visited once
+        symmetricSpans(x, y, yOffset, xOffset, op);
+        
+        ++yOffset;
+        if (error < 0)
+            error += (2 * yOffset) + 1;
+        else
+        {
+            //Lines xOffset away (in the mirrored octant) are finished, as wide as the last yOffset
+            //Unless they were already drawn by the other half of the loop
+            if (xOffset >= yOffset)
+                symmetricSpans(x, y, xOffset, yOffset - 1, op);
+            
+            --xOffset;
+            error += (2 * (yOffset - xOffset)) + 1;
+        }
+    }
+}
+
+//Applies op to the outline of an ellipse or if fill, one span per line to fill it in
+//One quadrant is stepped through with the Bresenham ellipse algorithm and mirrored
+static inline __attribute__ ((always_inline)) void ellipse(int32_t x, int32_t y, uint32_t radiusX, uint32_t radiusY, bool fill, uint_fast8_t op)
+{
+    //members.chello.at/~easyfilter/bresenham.html
+    if (outsideClip(x, y, radiusX, radiusY))
+        return;
+    
+    if (!fill)//Spans mark themselves
+        clippedDamage(x - (int32_t)radiusX, y - (int32_t)radiusY, x + (int32_t)radiusX, y + (int32_t)radiusY);
+    
+    const int64_t radiusX2 = (int64_t)radiusX * radiusX;
+    const int64_t radiusY2 = (int64_t)radiusY * radiusY;
+    
+    //Start at the left end and go towards the top
+    int32_t xOffset = -(int32_t)radiusX, yOffset = 0;
+    int64_t error = (xOffset * ((2 * radiusY2) + xOffset)) + radiusY2;//Error of the first step
+    bool newLine = true;
+    
+    do
+    {
+        if (fill)
+        {
+            if (newLine)//The first pixel on a line is the widest
+                symmetricSpans(x, y, yOffset, -xOffset, op);
+        }
+        else
+            symmetricPoints(x, y, xOffset, yOffset, op);
+        
+        const int64_t doubleError = 2 * error;
+        newLine = false;
+        
+        if (doubleError >= (((xOffset * 2) + 1) * radiusY2))//errorXY + errorX > 0
+        {
+            ++xOffset;
+            error += ((xOffset * 2) + 1) * radiusY2;
+        }
+        
+        if (doubleError <= (((yOffset * 2) + 1) * radiusX2))//errorXY + errorY < 0
+        {
+            ++yOffset;
+            error += ((yOffset * 2) + 1) * radiusX2;
+            newLine = true;
+        }
+    }
+    while (xOffset <= 0);
+    
+    //Very flat ellipses stop early; finish the tips
+    while (yOffset < (int32_t)radiusY)
+    {
+        if (!newLine)
+            ++yOffset;
+        newLine = false;
+        
+        if (fill)
+            symmetricSpans(x, y, yOffset, 0, op);
+        else
+            symmetricPoints(x, y, 0, yOffset, op);
+    }
+}
+
+//8 pixels of a row of a bitmap starting at any bit (pixels are MSB first, so the first one ends up
+//in the top bit). Nothing past the byte with lastBit (the last pixel used) is read; the pixels
+//that would come from there are 0 instead (they are past the end of the span, so aren't needed)
+static inline __attribute__ ((always_inline)) uint8_t fetchByte(const uint8_t* row, int32_t bit, int32_t lastBit)
+{
+    const uint8_t* const byte = row + (bit / 8);
+    const uint_fast8_t shift = bit % 8;
+    
+    if (!shift)
+        return byte[0];
+    
+    const uint8_t next = ((bit / 8) < (lastBit / 8)) ? byte[1] : 0;
+    return (byte[0] << shift) | (next >> (8 - shift));
+}
+
+//The aligned word at address with its pixels in order (byteswapped, since it's little endian)
+//Only bytes from first to last (the ones the span uses) are read; the rest are 0 (and not needed)
+static inline __attribute__ ((always_inline)) uint32_t fetchWord(uintptr_t address, uintptr_t first, uintptr_t last)
+{
+    if ((address >= first) && ((address + 3) <= last))
+        return __builtin_bswap32(*(const word_t*)address);
+    
+    //Partly outside the span (at the start or end of it): byte at a time
+    uint32_t bits = 0;
+    for (uint_fast8_t i = 0; i < 4; ++i)
+    {
+        bits <<= 8;
+        if (((address + i) >= first) && ((address + i) <= last))
+            bits |= *(const uint8_t*)(address + i);
+    }
+    
+    return bits;
+}
+
+//What rop does to the pixels of destination set in mask, given the source pixels (works on bytes
+//and words in either bit order, since every bit is independent)
+static inline __attribute__ ((always_inline)) uint32_t applySource(uint32_t destination, uint32_t source, uint32_t mask, uint_fast8_t rop)
+{
+    switch (rop)
+    {
+        case SR_BLIT_COPY:
+            return (destination & ~mask) | (source & mask);
+        case SR_BLIT_OR:
+            return destination | (source & mask);
+        case SR_BLIT_AND:
+            return destination & (source | ~mask);
+        case SR_BLIT_XOR:
+            return destination ^ (source & mask);
+        default://SR_BLIT_AND_NOT
+            return destination & ~(source & mask);
+    }
+}
+
+//Applies rop with xCount pixels of sourceRow starting at sourceBit (only where maskRow is set if
+//masked) to line y starting at x (already clipped)
+//Like fillSpan, the partial bytes at the ends are masked and the middle is done a word at a time.
+//The source words for the middle are loaded once each and funnel shifted to line up with it
+//Only the bytes of sourceRow/maskRow with the span's pixels in them are read
+static inline __attribute__ ((always_inline)) void blitRow(const uint8_t* sourceRow, const uint8_t* maskRow, int32_t sourceBit, int32_t x, int32_t y, int32_t xCount, bool masked, uint_fast8_t rop)
+{
+    const int32_t firstBit = sourceBit;//First and last source pixels of the span
+    const int32_t lastBit = sourceBit + xCount - 1;
+    const int32_t end = x + xCount - 1;//Last pixel of the span
+    uint8_t* const line = SR_line(y);
+    uint8_t* destination = line + (x / 8);
+    uint8_t* const last = line + (end / 8);
+    const uint8_t leftMask = 0xFF >> (x % 8);
+    const uint8_t rightMask = 0xFF << (7 - (end % 8));
+    
+    //First byte (the source is shifted right to line up with x)
+    {
+        const uint8_t sourceByte = fetchByte(sourceRow, sourceBit, lastBit) >> (x % 8);
+        const uint8_t maskByte = masked ? (fetchByte(maskRow, sourceBit, lastBit) >> (x % 8)) : 0xFF;
+        const uint8_t edgeMask = (destination == last) ? (leftMask & rightMask) : leftMask;
+        
+        *destination = applySource(*destination, sourceByte, maskByte & edgeMask, rop);
+        
+        if (destination == last)
+            return;
+        
+        ++destination;
+        sourceBit += 8 - (x % 8);//Source bit for the first pixel of destination from now on
+    }
+    
+    //Whole bytes until the next word boundary
+    while ((destination < last) && ((uintptr_t)destination & 0b11))
+    {
+        const uint8_t maskByte = masked ? fetchByte(maskRow, sourceBit, lastBit) : 0xFF;
+        *destination = applySource(*destination, fetchByte(sourceRow, sourceBit, lastBit), maskByte, rop);
+        ++destination;
+        sourceBit += 8;
+    }
+    
+    //Whole words (one word of the source and mask loaded each, and the one before carried over)
+    //The first word loaded can start before the span and the last can end after it, so those two
+    //only read the bytes inside it; the ones in between are always inside
+    if ((last - destination) >= 4)
+    {
+        const uintptr_t sourceAddress = (uintptr_t)sourceRow + (sourceBit / 8);
+        const uintptr_t sourceFirst = (uintptr_t)sourceRow + (firstBit / 8);
+        const uintptr_t sourceLast = (uintptr_t)sourceRow + (lastBit / 8);
+        uintptr_t sourceWord = sourceAddress & ~(uintptr_t)0b11;
+        const uint_fast8_t sourceShift = ((sourceAddress & 0b11) * 8) + (sourceBit % 8);
+        uint32_t sourceHigh = fetchWord(sourceWord, sourceFirst, sourceLast);
+        sourceWord += 4;
+        
+        const uintptr_t maskAddress = (uintptr_t)maskRow + (sourceBit / 8);
+        const uintptr_t maskFirst = (uintptr_t)maskRow + (firstBit / 8);
+        const uintptr_t maskLast = (uintptr_t)maskRow + (lastBit / 8);
+        uintptr_t maskWord = maskAddress & ~(uintptr_t)0b11;
+        const uint_fast8_t maskShift = ((maskAddress & 0b11) * 8) + (sourceBit % 8);
+        uint32_t maskHigh = masked ? fetchWord(maskWord, maskFirst, maskLast) : 0;
+        maskWord += 4;
+        
+        while ((last - destination) >= 4)
+        {
+            //Words loaded for all but the last destination word are inside the span
+            const bool inside = (last - destination) >= 8;
+            const uint32_t sourceLow = inside ? __builtin_bswap32(*(const word_t*)sourceWord) : fetchWord(sourceWord, sourceFirst, sourceLast);
+            sourceWord += 4;
+            const uint32_t sourceBits = sourceShift ? ((sourceHigh << sourceShift) | (sourceLow >> (32 - sourceShift))) : sourceHigh;
+            sourceHigh = sourceLow;
+            
+            uint32_t maskBits = 0xFFFFFFFF;
+            if (masked)
+            {
+                const uint32_t maskLow = inside ? __builtin_bswap32(*(const word_t*)maskWord) : fetchWord(maskWord, maskFirst, maskLast);
+                maskWord += 4;
+                maskBits = maskShift ? ((maskHigh << maskShift) | (maskLow >> (32 - maskShift))) : maskHigh;
+                maskHigh = maskLow;
+            }
+            
+            //Back to memory order instead of converting the destination
+            *(word_t*)destination = applySource(*(word_t*)destination, __builtin_bswap32(sourceBits), __builtin_bswap32(maskBits), rop);
+            destination += 4;
+            sourceBit += 32;
+        }
+    }
+    
+    //Whole bytes left over
+    while (destination < last)
+    {
+        const uint8_t maskByte = masked ? fetchByte(maskRow, sourceBit, lastBit) : 0xFF;
+        *destination = applySource(*destination, fetchByte(sourceRow, sourceBit, lastBit), maskByte, rop);
+        ++destination;
+        sourceBit += 8;
+    }
+    
+    //Last byte
+    const uint8_t maskByte = masked ? fetchByte(maskRow, sourceBit, lastBit) : 0xFF;
+    *last = applySource(*last, fetchByte(sourceRow, sourceBit, lastBit), maskByte & rightMask, rop);
+}
+
+//Applies rop with the xCount by yCount pixel area of source at (sourceX, sourceY) to the
+//framebuffer at (x, y) (only where mask is set if masked), clipped to the clip rectangle
+static inline __attribute__ ((always_inline)) void blit(const uint8_t* source, const uint8_t* mask, uint32_t sourceStride, int32_t sourceX, int32_t sourceY, int32_t xCount, int32_t yCount, int32_t x, int32_t y, bool masked, uint_fast8_t rop)
+{
+    //Clip the destination and move the source area along with it
+    const int32_t left = SR_max(x, clipLeft);
+    const int32_t top = SR_max(y, clipTop);
+    const int32_t right = SR_min(x + xCount, clipRight);//Exclusive
+    const int32_t bottom = SR_min(y + yCount, clipBottom);//Exclusive
+    
+    if ((left >= right) || (top >= bottom))
+        return;
+    
+    damage(left, top, right - 1, bottom - 1);
+    
+    sourceX += left - x;
+    const uint8_t* sourceRow = source + ((sourceY + (top - y)) * sourceStride);
+    const uint8_t* maskRow = masked ? (mask + ((sourceY + (top - y)) * sourceStride)) : 0;
+    
+    for (y = top; y < bottom; ++y)
+    {
+        blitRow(sourceRow, maskRow, sourceX, left, y, right - left, masked, rop);
+        sourceRow += sourceStride;
+        if (masked)
+            maskRow += sourceStride;
+    }
+}
@@ -1,37 +1,69 @@
 /* Useful library for drawing to composite frame buffers
- * NO OUT OF BOUNDS CHECKING OTHER THAN SOME ASSERTIONS! BE CAREFUL! #define NDEBUG for speed
+ * Everything is clipped to the clip rectangle (the whole framebuffer by default), and positions are
+ * signed so things can hang off any side of it
  * 
 ** Function Listing
  * Most functions can be suffixed with _I for white on black instead of the usual black on white 
- * framebuffer and _X for xoring onto the framebuffer, so only the "base" functions are listed.
+ * framebuffer, _X for xoring onto the framebuffer, and _P/_N to copy/clear with a pattern, so only
+ * the "base" functions are listed.
  * 
  * Initialization (No suffixes)
  *  void SR_setFrameBuffer(uint8_t* frameBuffer);//Composite framebuffer for all functions
  *  void SR_setCharacterRom(const uint8_t characterRom[128][8]);//8x8 and in ASCII order; W on B
+ *  void SR_setPattern(const uint8_t pattern[8]);//8x8 pattern for the _P and _N functions
+ *  void SR_setClip(int32_t x, int32_t y, uint32_t xCount, uint32_t yCount);//Only draw inside this
+ *  void SR_resetClip();//Clip to the whole framebuffer again
  * 
- * Screen Manipulation
- *  //TODO
+ * Dirty Region Tracking (No suffixes; only if SR_DIRTY_TRACKING is defined)
+ *  bool SR_getDirtyLine(uint32_t y, uint32_t* xByte, uint32_t* xCount);//Bytes of line y drawn to
+ *  bool SR_getDirtyArea(uint32_t* xByte, uint32_t* y, uint32_t* xCount, uint32_t* yCount);
+ *  void SR_markDirty(int32_t x, int32_t y, uint32_t xCount, uint32_t yCount);
+ *  void SR_resetDirty();
+ * 
+ * Bitmap Drawing (No suffixes; the raster operation is a parameter)
+ *  void SR_blit(const uint8_t* source, uint32_t sourceStride, int32_t sourceX, int32_t sourceY, uint32_t xCount, uint32_t yCount, int32_t x, int32_t y, uint_fast8_t rop);
+ *  void SR_blitMasked(const uint8_t* source, const uint8_t* mask, uint32_t sourceStride, int32_t sourceX, int32_t sourceY, uint32_t xCount, uint32_t yCount, int32_t x, int32_t y, uint_fast8_t rop);
+ * 
+ * Display Lists (No suffixes; only if SR_DISPLAY_LISTS is defined)
+ *  void SR_initList(SR_displayList_t* list, SR_listEntry_t* arena, uint32_t size);
+ *  void SR_clearList(SR_displayList_t* list);
+ *  void SR_beginList(SR_displayList_t* list);//Record drawing functions into list instead of drawing
+ *  void SR_endList();
+ *  void SR_replayList(const SR_displayList_t* list);
+ *  bool SR_replayListPart(SR_displayList_t* list, bool (*keepGoing)(void));
+ *  void SR_replayListLines(const SR_displayList_t* list, int32_t top, int32_t bottom);
+ * 
+ * Screen Manipulation (No suffixes; done by DMA in the background if SR_DMA_CHANNEL is defined)
+ *  void SR_fillArea(int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount, uint8_t value, void (*done)(void));
+ *  void SR_copyArea(const uint8_t* source, uint32_t sourceStride, int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount, void (*done)(void));
+ *  SR_clear();//Macros (fill the whole framebuffer with 0x00/0xFF)
+ *  SR_fill();
+ *  bool SR_isBusy();
+ *  void SR_waitUntilDone();
  * 
  * Point Drawing
- *  void SR_writeToByte(uint32_t xByte, uint32_t y, uint8_t data);//No Suffixes
- *  void SR_drawPointByByte(uint32_t xByte, uint32_t y);
- *  void SR_drawPoint(uint32_t x, uint32_t y);
+ *  void SR_writeToByte(int32_t xByte, int32_t y, uint8_t data);//No Suffixes
+ *  void SR_drawPointByByte(int32_t xByte, int32_t y);
+ *  void SR_drawPoint(int32_t x, int32_t y);
  * 
  * Character/String Drawing
- *  void SR_drawCharByByte(uint32_t xByte, uint32_t y, char c);
- *  void SR_drawStringByByte(uint32_t xByte, uint32_t y, const char* string);//No Suffixes//TODO
- *  void SR_drawText(uint32_t xByte, uint32_t y, const char* string);
+ *  void SR_drawCharByByte(int32_t xByte, int32_t y, char c);
+ *  void SR_drawStringByByte(int32_t xByte, int32_t y, const char* string);//No Suffixes//TODO
+ *  void SR_drawText(int32_t xByte, int32_t y, const char* string);
  * 
  * Line Drawing
- *  void SR_drawHLineByByte(uint32_t xByte, uint32_t y, uint32_t xCount);//No Suffixes//TODO
- *  void SR_drawVLineByByte(uint32_t xByte, uint32_t y, uint32_t yCount);//No Suffixes//TODO
- *  void SR_drawHLine(uint32_t x, uint32_t y, uint32_t xCount);
- *  void SR_drawVLine(uint32_t x, uint32_t y, uint32_t yCount);
+ *  void SR_drawHLineByByte(int32_t xByte, int32_t y, uint32_t xCount);//No Suffixes
+ *  void SR_drawVLineByByte(int32_t xByte, int32_t y, uint32_t yCount);//No Suffixes
+ *  void SR_drawHLine(int32_t x, int32_t y, uint32_t xCount);
+ *  void SR_drawVLine(int32_t x, int32_t y, uint32_t yCount);
  * 
- * Shape Drawing (Also _F suffix for filled (Shape outline is default))
- *  void SR_drawRectangleByByte(uint32_t xByte, uint32_t y, uint32_t xCount, uint32_t yCount);
- *  void SR_drawRectangle(uint32_t x, uint32_t y, uint32_t xCount, uint32_t yCount);
- *  void SR_drawTriangle(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2);//No Suffixes//TODO
+ * Shape Drawing (Also _F suffix for filled (Shape outline is default); _F_I and _F_X for both)
+ *  void SR_drawRectangleByByte(int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount);
+ *  void SR_drawRectangle(int32_t x, int32_t y, uint32_t xCount, uint32_t yCount);
+ *  void SR_drawTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2);
+ *  void SR_drawCircle(int32_t x, int32_t y, uint32_t radius);
+ *  void SR_drawArc(int32_t x, int32_t y, uint32_t radius, uint32_t startAngle, uint32_t endAngle);//No _F
+ *  void SR_drawEllipse(int32_t x, int32_t y, uint32_t radiusX, uint32_t radiusY);
  *  
 */
 
@@ -39,99 +71,183 @@
 #define SOFTRENDERER_H
 
 #include "bluepill.h"
+#include "composite.h"
 
 /* Settings (must be filled in) */
-//Defaults
+//Defaults (test.c's ram framebuffer)
 #define SR_BYTES_PER_LINE 59
-#define SR_LINES 241
+#define SR_LINES COMPOSITE_LINES//242, or 288 with COMPOSITE_PAL
+
+//Record which bytes of each line are drawn to (see SR_getDirtyLine), so only the parts of the
+//framebuffer that changed need to be cleared/sent/redrawn. Makes every drawing function slightly slower
+//#define SR_DIRTY_TRACKING
+
+//Allow drawing functions to be recorded into display lists and replayed later (see SR_beginList)
+//Every drawing function checks if it is being recorded first
+//#define SR_DISPLAY_LISTS
+
+//Draw single pixels (points, and circle/ellipse/arc outlines) through the Cortex-M3 SRAM bit-band
+//alias: one store per pixel that can't disturb the rest of the byte, even if an interrupt draws to
+//it at the same time. The framebuffer must be in SRAM
+//#define SR_BIT_BAND
+
+//Do SR_fillArea/SR_copyArea (and so SR_clear/SR_fill) in the background with this DMA1 channel in
+//memory to memory mode while the CPU keeps rendering. Composite uses channel 3 (and 4, 5 or 7
+//depending on its settings), so use 1, 2 or 6. The channel has the lowest priority, so video DMA
+//requests always go first. Ignored when not compiling for ARM (the CPU does them instead)
+//#define SR_DMA_CHANNEL 6
+#define SR_DMA_QUEUE_LENGTH 8//Requests that can be queued at once is one less than this
 
 /* Public functions and macros */
 //ByByte functions are faster as they don't require bit manipulation, but give you less control
 //Functions suffixed with _I mean inverted (draw black pixels instead of white)
 //Functions suffixed with _X xor existing pixels to invert things
+//Functions suffixed with _P copy the pattern (see SR_setPattern) into the pixels they draw
+//Functions suffixed with _N clear the pixels they draw that are set in the pattern
 //Functions suffixed with _OW mean that they overwrite other bits within a byte for speed
 //Shape drawing functions suffixed with _F fill their shape in (instead of just a border)
 
+//Declares name and its _I, _X, _P and _N versions (all taking the parameters)
+//Each one is compiled separately with the pixel operation inlined into its inner loops
+#define SR_DECLARE_ROPS(name, ...) \
+    void name(__VA_ARGS__); \
+    void name##_I(__VA_ARGS__); \
+    void name##_X(__VA_ARGS__); \
+    void name##_P(__VA_ARGS__); \
+    void name##_N(__VA_ARGS__);
+
 //Initialization Functions (Pointers used by drawing functions)
 //Note that these can be changed at any point (provided a draw function isn't running)
 //This can allow for double/multiple buffering to avoid screen tearing
 void SR_setFrameBuffer(uint8_t* frameBuffer);//Must have dimensions specified above
 void SR_setCharacterRom(const uint8_t characterRom[128][8]);//8x8 and in ASCII order; W on black
+void SR_setPattern(const uint8_t pattern[8]);//Copied; row y % 8 is used on line y (checkerboard by default)
+//Nothing outside the clip rectangle is drawn (it is limited to the framebuffer). Lines are cut
+//down to the part inside before they are stepped through, and everything else is clipped per
+//span/column, so off-screen parts of shapes cost little
+void SR_setClip(int32_t x, int32_t y, uint32_t xCount, uint32_t yCount);
+void SR_resetClip();//The whole framebuffer (the default)
+
+//Dirty Region Tracking
+//Everything drawn (inside the clip rectangle) since the last SR_resetDirty is recorded as a range of
+//bytes on each line. Shapes record their bounding box, lines the box between their ends
+#ifdef SR_DIRTY_TRACKING
+bool SR_getDirtyLine(uint32_t y, uint32_t* xByte, uint32_t* xCount);//False if nothing on line y was drawn to
+bool SR_getDirtyArea(uint32_t* xByte, uint32_t* y, uint32_t* xCount, uint32_t* yCount);//Box around every dirty line; false if none
+void SR_markDirty(int32_t x, int32_t y, uint32_t xCount, uint32_t yCount);//For changes not made with SR functions
+void SR_resetDirty();
+#endif
+
+//Display Lists
+//Between SR_beginList and SR_endList, drawing functions (and SR_setPattern) are added to the list
+//instead of running, and can be replayed later as many times as needed, for example to redraw a
+//static overlay without redoing its layout, or to draw during vblank/behind the beam to avoid
+//tearing without a second framebuffer:
+// - SR_replayListPart, with keepGoing checking Composite_getCurrentLine() is COMPOSITE_LINES,
+//   draws as much as fits into each vblank and carries on from there the next time
+// - SR_replayListLines with lines above Composite_getCurrentLine() draws just those lines; calling
+//   it again for the lines the beam has passed since then races the beam down the screen
+//Strings and patterns are recorded as pointers, so they must still exist when replaying
+//Clip changes aren't recorded (the clip rectangle when replaying applies)
+#ifdef SR_DISPLAY_LISTS
+typedef union SR_listEntry
+{
+    void (*replay)(const union SR_listEntry* arguments);//First entry of a command; calls it with the arguments
+    intptr_t value;//Number of arguments, then the arguments
+} SR_listEntry_t;//A command takes 2 entries plus 1 per argument (a line takes 6)
+
+typedef struct
+{
+    SR_listEntry_t* entries;//Arena the commands are recorded into
+    uint32_t size;//Number of entries in the arena
+    uint32_t length;//Number of entries recorded
+    uint32_t position;//Entry SR_replayListPart carries on from
+    bool overflowed;//A command didn't fit, so it and everything recorded after it was dropped
+} SR_displayList_t;
+
+void SR_initList(SR_displayList_t* list, SR_listEntry_t* arena, uint32_t size);//Also clears list
+void SR_clearList(SR_displayList_t* list);//Remove all of the commands
+void SR_beginList(SR_displayList_t* list);//Start recording (adds to what list already has)
+void SR_endList();//Stop recording and draw normally again
+void SR_replayList(const SR_displayList_t* list);//All of the commands (into the current list if recording)
+//Replays commands from where the last call stopped while keepGoing() returns true; true if it reached
+//the end (the next call starts from the beginning again)
+bool SR_replayListPart(SR_displayList_t* list, bool (*keepGoing)(void));
+void SR_replayListLines(const SR_displayList_t* list, int32_t top, int32_t bottom);//Only lines top to bottom - 1
+#endif
 
 //Point Drawing
-void SR_writeToByte(uint32_t xByte, uint32_t y, uint8_t data);
-void SR_drawPointByByte(uint32_t xByte, uint32_t y);
-void SR_drawPointByByte_I(uint32_t xByte, uint32_t y);
-void SR_drawPointByByte_X(uint32_t xByte, uint32_t y);
-void SR_drawPoint(uint32_t x, uint32_t y);
-void SR_drawPoint_I(uint32_t x, uint32_t y);
-void SR_drawPoint_X(uint32_t x, uint32_t y);
+void SR_writeToByte(int32_t xByte, int32_t y, uint8_t data);
+void SR_drawPointByByte(int32_t xByte, int32_t y);
+void SR_drawPointByByte_I(int32_t xByte, int32_t y);
+void SR_drawPointByByte_X(int32_t xByte, int32_t y);
+SR_DECLARE_ROPS(SR_drawPoint, int32_t x, int32_t y)
 
 //Screen Manipulation
-//TODO implement memset in bluepill.h
-//#define SR_clear(fb) {memset(fb, 0x00, BYTES_PER_LINE * LINES);}
-//#define SR_fill(fb) {memset(fb, 0xFF, BYTES_PER_LINE * LINES);}
+//Fill or copy whole bytes of an area of the framebuffer (limited to the framebuffer, not the clip
+//rectangle), a word at a time where possible. done (if not 0) is called once the area is finished
+//With SR_DMA_CHANNEL, requests are queued and done in order by DMA, and these return straight away
+//(waiting first if the queue is full). done is called from the DMA interrupt, so it should be short
+//and must not queue requests itself. Anything drawn over an area before its request is done may be
+//overwritten, so wait for done or SR_waitUntilDone first. They must not be called from interrupts
+//Otherwise (or when nothing is left after limiting the area) they are done before returning
+void SR_fillArea(int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount, uint8_t value, void (*done)(void));
+//source points to the first byte to copy, and has sourceStride bytes per row (SR_BYTES_PER_LINE to
+//scroll part of the framebuffer). Copying onto itself works in any direction except to the right
+//when the rows overlap (lines are done bottom to top when moving down)
+void SR_copyArea(const uint8_t* source, uint32_t sourceStride, int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount, void (*done)(void));
+bool SR_isBusy();//Requests are still queued or in progress (always false without SR_DMA_CHANNEL)
+void SR_waitUntilDone();//Waits for every request to finish
+#define SR_clear() SR_fillArea(0, 0, SR_BYTES_PER_LINE, SR_LINES, 0x00, 0)
+#define SR_fill() SR_fillArea(0, 0, SR_BYTES_PER_LINE, SR_LINES, 0xFF, 0)
 
 //Char/String Drawing (characters in charRom should be 8 by 8 and in ascii order sequentially)
-void SR_drawCharByByte(uint32_t xByte, uint32_t y, char c);
-void SR_drawCharByByte_I(uint32_t xByte, uint32_t y, char c);
-void SR_drawCharByByte_X(uint32_t xByte, uint32_t y, char c);
-void SR_drawStringByByte(uint32_t xByte, uint32_t y, const char* string);//Faster
-//SR_drawText(_I,_X) take (uint32_t xByte, uint32_t y, const char* string)
-#define SR_drawText(xByte, y, string) _SR_drawText(xByte, y, string, SR_drawCharByByte)
-#define SR_drawText_I(xByte, y, string) _SR_drawText(xByte, y, string, SR_drawCharByByte_I)
-#define SR_drawText_X(xByte, y, string) _SR_drawText(xByte, y, string, SR_drawCharByByte_X)
-
-//Line Drawing
-void SR_drawHLineByByte(uint32_t xByte, uint32_t y, uint32_t xCount);
-void SR_drawVLineByByte(uint32_t xByte, uint32_t y, uint32_t yCount);
-//SR_drawHLine and SR_drawHLine_X take (uint32_t x, uint32_t y, uint32_t xCount)
-#define SR_drawHLine(x, y, xCount) _SR_drawHLine(x, y, xCount, SR_drawPoint)
-#define SR_drawHLine_I(x, y, xCount) _SR_drawHLine(x, y, xCount, SR_drawPoint_I)
-#define SR_drawHLine_X(x, y, xCount) _SR_drawHLine(x, y, xCount, SR_drawPoint_X)
-//SR_drawVLine and SR_drawVLine_X take (uint32_t x, uint32_t y, uint32_t yCount)
-#define SR_drawVLine(x, y, yCount) _SR_drawVLine(x, y, yCount, SR_drawPoint)
-#define SR_drawVLine_I(x, y, yCount) _SR_drawVLine(x, y, yCount, SR_drawPoint_I)
-#define SR_drawVLine_X(x, y, yCount) _SR_drawVLine(x, y, yCount, SR_drawPoint_X)
-
-//SR_drawLineByByte(_I,_X) takes (uint32_t xByte1, uint32_t y1, uint32_t xByte2, uint32_t y2);
-#define SR_drawLineByByte(x0, y0, x1, y1) _SR_drawLine(x0, y0, x1, y1, SR_drawPointByByte)
-#define SR_drawLineByByte_I(x0, y0, x1, y1) _SR_drawLine(x0, y0, x1, y1, SR_drawPointByByte_I)
-#define SR_drawLineByByte_X(x0, y0, x1, y1) _SR_drawLine(x0, y0, x1, y1, SR_drawPointByByte_X)
-//SR_drawLine(_I,_X) takes (uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
-#define SR_drawLine(x0, y0, x1, y1) _SR_drawLine(x0, y0, x1, y1, SR_drawPoint)
-#define SR_drawLine_I(x0, y0, x1, y1) _SR_drawLine(x0, y0, x1, y1, SR_drawPoint_I)
-#define SR_drawLine_X(x0, y0, x1, y1) _SR_drawLine(x0, y0, x1, y1, SR_drawPoint_X)
-
-//Shape Drawing
-//SR_drawRectangleByByte(_I,_X) takes (uint32_t xByte, uint32_t y, uint32_t xCount, uint32_t yCount)
-#define SR_drawRectangleByByte(xByte, y, xCount, yCount) _SR_drawRectangle(xByte, y, xCount, yCount, SR_drawPointByByte)
-#define SR_drawRectangleByByte_I(xByte, y, xCount, yCount) _SR_drawRectangle(xByte, y, xCount, yCount, SR_drawPointByByte_I)
-#define SR_drawRectangleByByte_X(xByte, y, xCount, yCount) _SR_drawRectangle(xByte, y, xCount, yCount, SR_drawPointByByte_X)
-void SR_drawRectangleByByte_F(uint32_t xByte, uint32_t y, uint32_t xCount, uint32_t yCount);
-//SR_drawRectangle(_I, _X) takes (uint32_t x, uint32_t y, uint32_t xCount, uint32_t yCount)
-#define SR_drawRectangle(x, y, xCount, yCount) _SR_drawRectangle(x, y, xCount, yCount, SR_drawPoint)
-#define SR_drawRectangle_I(x, y, xCount, yCount) _SR_drawRectangle(x, y, xCount, yCount, SR_drawPoint_I)
-#define SR_drawRectangle_X(x, y, xCount, yCount) _SR_drawRectangle(x, y, xCount, yCount, SR_drawPoint_X)
-void SR_drawRectangle_F(uint32_t x, uint32_t y, uint32_t xCount, uint32_t yCount);
-
-void SR_drawTriangle(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2);
-
-void SR_drawCircleByByte(uint32_t xByte, uint32_t y, uint32_t radius);
-void SR_drawCircleByByte_F(uint32_t xByte, uint32_t y, uint32_t radius);
-
-/* Public Functions Called By Public Macros */
-//Costs performance, but improves maintainability
-
-//Char/String Drawing
-void _SR_drawText(uint32_t xByte, uint32_t y, const char* string, void (*drawCharByByte)(uint32_t, uint32_t, char));
+SR_DECLARE_ROPS(SR_drawCharByByte, int32_t xByte, int32_t y, char c)
+void SR_drawStringByByte(int32_t xByte, int32_t y, const char* string);//Faster
+SR_DECLARE_ROPS(SR_drawText, int32_t xByte, int32_t y, const char* string)
 
 //Line Drawing
-void _SR_drawHLine(uint32_t x, uint32_t y, uint32_t xCount, void (*plot)(uint32_t, uint32_t));
-void _SR_drawVLine(uint32_t x, uint32_t y, uint32_t yCount, void (*plot)(uint32_t, uint32_t));
-void _SR_drawLine(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, void (*plot)(uint32_t, uint32_t));
+void SR_drawHLineByByte(int32_t xByte, int32_t y, uint32_t xCount);
+void SR_drawVLineByByte(int32_t xByte, int32_t y, uint32_t yCount);
+SR_DECLARE_ROPS(SR_drawHLine, int32_t x, int32_t y, uint32_t xCount)//Masks the ends, fills the middle by word
+SR_DECLARE_ROPS(SR_drawVLine, int32_t x, int32_t y, uint32_t yCount)
+SR_DECLARE_ROPS(SR_drawLineByByte, int32_t xByte0, int32_t y0, int32_t xByte1, int32_t y1)//_X xors whole bytes
+SR_DECLARE_ROPS(SR_drawLine, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
 
 //Shape Drawing
-void _SR_drawRectangle(uint32_t x, uint32_t y, uint32_t xCount, uint32_t yCount, void (*plot)(uint32_t, uint32_t));
+//Rectangles are built from horizontal spans (and columns for the sides of outlines)
+SR_DECLARE_ROPS(SR_drawRectangleByByte, int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount)
+SR_DECLARE_ROPS(SR_drawRectangleByByte_F, int32_t xByte, int32_t y, uint32_t xCount, uint32_t yCount)
+SR_DECLARE_ROPS(SR_drawRectangle, int32_t x, int32_t y, uint32_t xCount, uint32_t yCount)
+SR_DECLARE_ROPS(SR_drawRectangle_F, int32_t x, int32_t y, uint32_t xCount, uint32_t yCount)
+
+//Same pixels as SR_drawLine between each pair of points, but each one is only touched once (for _X)
+SR_DECLARE_ROPS(SR_drawTriangle, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2)
+//Pixels with their centres inside are filled; ones exactly on an edge only if it's a left edge
+//so triangles that share an edge can be drawn with _X without gaps or double xoring
+SR_DECLARE_ROPS(SR_drawTriangle_F, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2)
+
+//Centred on (x, y). Outlines touch every pixel once, and filled shapes are one span per line
+SR_DECLARE_ROPS(SR_drawCircle, int32_t x, int32_t y, uint32_t radius)
+SR_DECLARE_ROPS(SR_drawCircle_F, int32_t x, int32_t y, uint32_t radius)
+//Part of a circle from startAngle to endAngle (degrees counterclockwise from 3 o'clock)
+//The whole circle is drawn if they are the same
+SR_DECLARE_ROPS(SR_drawArc, int32_t x, int32_t y, uint32_t radius, uint32_t startAngle, uint32_t endAngle)
+SR_DECLARE_ROPS(SR_drawEllipse, int32_t x, int32_t y, uint32_t radiusX, uint32_t radiusY)
+SR_DECLARE_ROPS(SR_drawEllipse_F, int32_t x, int32_t y, uint32_t radiusX, uint32_t radiusY)
+
+//Bitmap Drawing
+//Bitmaps are 1bpp, MSB first, sourceStride bytes per row (like the framebuffer and bitmaps/*.h)
+//Any area of a bitmap can be drawn at any position; everything is shifted into place a word at a time
+//Bitmaps are read a word at a time where they can be, but only the bytes with pixels being drawn
+//sourceX and sourceY must not be negative
+#define SR_BLIT_COPY 0//Copy the source
+#define SR_BLIT_OR 1//Set pixels that are set in the source
+#define SR_BLIT_AND 2//Clear pixels that are clear in the source
+#define SR_BLIT_XOR 3//Invert pixels that are set in the source
+#define SR_BLIT_AND_NOT 4//Clear pixels that are set in the source
+void SR_blit(const uint8_t* source, uint32_t sourceStride, int32_t sourceX, int32_t sourceY, uint32_t xCount, uint32_t yCount, int32_t x, int32_t y, uint_fast8_t rop);
+//Only pixels set in mask (a bitmap with the same layout as source) are changed
+void SR_blitMasked(const uint8_t* source, const uint8_t* mask, uint32_t sourceStride, int32_t sourceX, int32_t sourceY, uint32_t xCount, uint32_t yCount, int32_t x, int32_t y, uint_fast8_t rop);
 
 #endif//SOFTRENDERER_H
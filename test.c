@@ -14,11 +14,9 @@
 #include "bitmaps/about.h"
 
 //              y, x
-uint8_t ramFB[242][59];//59*8=472
+uint8_t ramFB[COMPOSITE_LINES][59];//59*8=472 (242 lines, or 288 with COMPOSITE_PAL)
 
 int32_t rand();
-void clearFaster();
-void fillFaster();
 void demo();
 
 void main()
@@ -28,7 +26,6 @@ void main()
     //while (true);
     
     //Ram framebuffer (464 by 242)
-    //fillFaster();
     Composite_init((uint8_t*)ramFB);
     //while (true);
     
@@ -55,30 +52,6 @@ int32_t rand()
     return seed;
 }
 
-void clearFaster()
-{
-    for (uint32_t i = 0; i < 242; ++i)
-    {
-        for (uint32_t j = 0; j < 59; ++j)
-        {
-            ramFB[i][j] = 0x00;
-            __delayInstructions(1000);
-        }
-    }
-}
-
-void fillFaster()
-{
-    for (uint32_t i = 0; i < 242; ++i)
-    {
-        for (uint32_t j = 0; j < 59; ++j)
-        {
-            ramFB[i][j] = 0xFF;
-            __delayInstructions(1000);
-        }
-    }
-}
-
 void demo()
 {
     while (true)
@@ -103,7 +76,8 @@ void demo()
         SR_drawText(1, 208, "Resolution: 472 by 242 (Limited by 20KiB of SRAM)");
         
         __delayInstructions(200000000);
-        fillFaster();
+        SR_fill();//In the background with SR_DMA_CHANNEL, so wait before drawing on top
+        SR_waitUntilDone();
         
         //Dots
         SR_drawText_I(27, 104, "Dots!");
@@ -117,7 +91,8 @@ void demo()
             __delayInstructions(1000);
         }
         __delayInstructions(72000000);
-        clearFaster();
+        SR_clear();
+        SR_waitUntilDone();
         
         //Lines
         SR_drawText(27, 104, "Lines!");
@@ -133,7 +108,8 @@ void demo()
             __delayInstructions(1000000);
         }
         __delayInstructions(72000000);
-        fillFaster();
+        SR_fill();
+        SR_waitUntilDone();
         
         //Rectangles
         SR_drawText_I(23, 104, "Rectangles!");
@@ -149,7 +125,8 @@ void demo()
             __delayInstructions(1000000);
         }
         __delayInstructions(72000000);
-        clearFaster();
+        SR_clear();
+        SR_waitUntilDone();
         
         //Triangles
         SR_drawText(23, 104, "Triangles!");
@@ -167,6 +144,7 @@ void demo()
             __delayInstructions(1000000);
         }
         __delayInstructions(72000000);
-        clearFaster();
+        SR_clear();
+        SR_waitUntilDone();
     }
 }